@@ -0,0 +1,119 @@
+#include <iostream>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <chrono>
+#include "../third_party/happly.h"
+#include "../custom_structs/bvh.hpp"
+
+// twists the triangles about the vertical axis through center, by up to angle radians at the top of the box
+void twist(Triangle *triangles, int num_triangles, const BoundingBox &bbox, float angle) {
+    Vec3 center((bbox.bounds[0] + bbox.bounds[1]) / 2.f, 0.f, (bbox.bounds[4] + bbox.bounds[5]) / 2.f);
+    auto deform = [&](const Vec3 &p) {
+        float a = angle * (p.y - bbox.bounds[2]) / (bbox.bounds[3] - bbox.bounds[2]);
+        float c = cosf(a);
+        float s = sinf(a);
+        return Vec3(center.x + c * (p.x - center.x) + s * (p.z - center.z), p.y,
+                    center.z - s * (p.x - center.x) + c * (p.z - center.z));
+    };
+    for (int i = 0; i < num_triangles; i++) {
+        const Triangle &trig = triangles[i];
+        triangles[i] = Triangle(deform(trig.p0), deform(trig.p1()), deform(trig.p2()));
+    }
+}
+
+// usage: bench-bvh [ply_path] [grid_size] [num_frames] [max_sah_growth]
+// the mesh is instanced grid_size^3 times on a regular grid to emulate larger scenes. Then each of num_frames frames
+// twists the scene a bit more and updates the BVH by refitting it, rebuilding it once its SAH cost grew by more than
+// max_sah_growth, and compares with rebuilding it every frame
+int main(int argc, char *argv[]) {
+    const char *ply_path = argc > 1 ? argv[1] : "../third_party/bun_zipper.ply";
+    int grid_size = argc > 2 ? std::atoi(argv[2]) : 1;
+    int num_frames = argc > 3 ? std::atoi(argv[3]) : 16;
+    float max_sah_growth = argc > 4 ? std::atof(argv[4]) : 1.5f;
+
+    happly::PLYData ply_data(ply_path);
+    std::vector<std::array<double, 3>> v_pos = ply_data.getVertexPositions();
+    std::vector<std::vector<size_t>> f_idx = ply_data.getFaceIndices<size_t>();
+
+    std::vector<Triangle> mesh;
+    for (int i = 0; i < f_idx.size(); i++) {
+        const std::vector<size_t> &face = f_idx[i];
+        mesh.emplace_back(Vec3(v_pos[face[0]][0], v_pos[face[0]][1], v_pos[face[0]][2]),
+                          Vec3(v_pos[face[1]][0], v_pos[face[1]][1], v_pos[face[1]][2]),
+                          Vec3(v_pos[face[2]][0], v_pos[face[2]][1], v_pos[face[2]][2]));
+    }
+
+    BoundingBox mesh_bbox = BoundingBox::Empty();
+    for (const Triangle &trig : mesh) mesh_bbox.extend(trig.bounding_box());
+    float spacing = fmaxf(mesh_bbox.bounds[1] - mesh_bbox.bounds[0],
+                          fmaxf(mesh_bbox.bounds[3] - mesh_bbox.bounds[2], mesh_bbox.bounds[5] - mesh_bbox.bounds[4]));
+
+    std::vector<Triangle> triangles;
+    for (int x = 0; x < grid_size; x++) {
+        for (int y = 0; y < grid_size; y++) {
+            for (int z = 0; z < grid_size; z++) {
+                Vec3 offset(x * spacing, y * spacing, z * spacing);
+                for (const Triangle &trig : mesh)
+                    triangles.emplace_back(trig.p0 + offset, trig.p1() + offset, trig.p2() + offset);
+            }
+        }
+    }
+
+    std::cout << "Scene has " << triangles.size() << " triangles, "
+              << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+    struct Result {
+        const char *name;
+        double build_ms;
+        float sah_cost;
+        int num_nodes;
+    };
+    std::vector<Result> results;
+    for (Bvh::BuildMethod build_method : { Bvh::BuildMethod::SWEEP, Bvh::BuildMethod::BINNED }) {
+        auto begin = std::chrono::steady_clock::now();
+        Bvh bvh(triangles, build_method);
+        auto end = std::chrono::steady_clock::now();
+        results.push_back({ build_method == Bvh::BuildMethod::SWEEP ? "sweep" : "binned",
+                            std::chrono::duration<double, std::milli>(end - begin).count(),
+                            bvh.sah_cost(), bvh.num_nodes });
+    }
+
+    struct Frame {
+        double update_ms;
+        bool rebuilt;
+        float sah_cost;
+        double rebuild_ms;
+        float rebuild_sah_cost;
+    };
+    std::vector<Frame> frames;
+    BoundingBox scene_bbox = BoundingBox::Empty();
+    for (const Triangle &trig : triangles) scene_bbox.extend(trig.bounding_box());
+    Bvh bvh(triangles, Bvh::BuildMethod::BINNED);
+    for (int frame = 0; frame < num_frames; frame++) {
+        twist(bvh.triangles, bvh.num_triangles, scene_bbox, 0.1f);
+
+        auto begin = std::chrono::steady_clock::now();
+        bool rebuilt = bvh.update(max_sah_growth, Bvh::BuildMethod::BINNED);
+        auto end = std::chrono::steady_clock::now();
+        float sah_cost = bvh.sah_cost();
+
+        auto rebuild_begin = std::chrono::steady_clock::now();
+        Bvh reference(std::vector<Triangle>(bvh.triangles, bvh.triangles + bvh.num_triangles), Bvh::BuildMethod::BINNED);
+        auto rebuild_end = std::chrono::steady_clock::now();
+        frames.push_back({ std::chrono::duration<double, std::milli>(end - begin).count(), rebuilt, sah_cost,
+                           std::chrono::duration<double, std::milli>(rebuild_end - rebuild_begin).count(),
+                           reference.built_sah_cost });
+    }
+
+    std::cout << std::endl << "builder\tbuild_ms\tsah_cost\tnum_nodes" << std::endl;
+    for (const Result &result : results)
+        std::cout << result.name << '\t' << result.build_ms << '\t' << result.sah_cost << '\t' << result.num_nodes << std::endl;
+
+    std::cout << std::endl << "frame\tupdate_ms\trebuilt\tsah_cost\trebuild_ms\trebuild_sah_cost" << std::endl;
+    for (int i = 0; i < (int)frames.size(); i++) {
+        const Frame &f = frames[i];
+        std::cout << i << '\t' << f.update_ms << '\t' << f.rebuilt << '\t' << f.sah_cost << '\t' << f.rebuild_ms << '\t'
+                  << f.rebuild_sah_cost << std::endl;
+    }
+}
@@ -0,0 +1,310 @@
+#include <cfloat>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <systemc>
+using namespace sc_core;
+using namespace sc_dt;
+
+#include "../modules/payloads.hpp"
+
+// kernel cost of the RAYGEN-RTCORE and RTCORE-SHADER interfaces, with one signal per payload field as RTCORE used to
+// have them, and with one Ray or RayResult signal per interface. SOURCE sends rays to STAGE, which returns a result
+// per ray to SINK; SINK takes a result on 3 cycles out of 4, so the handshakes also stall. Each layout runs in its own
+// process, so the kernel counts start from zero.
+// usage: bench-channels [num_rays]
+
+long long signal_updates = 0;
+long long activations = 0;
+
+// sc_signal counting its update phases, one per delta cycle in which it was written with a new value
+template<typename T>
+struct CountedSignal : public sc_signal<T> {
+    using sc_signal<T>::operator=;
+
+    void update() override {
+        signal_updates++;
+        sc_signal<T>::update();
+    }
+};
+
+// payload of one interface, as one signal per field or as a single signal
+template<typename T, bool Packed>
+struct Link;
+
+template<typename T>
+struct Link<T, true> {
+    CountedSignal<T> payload;
+
+    void write(const T &value) { payload = value; }
+    T read() const { return payload.read(); }
+};
+
+template<>
+struct Link<Ray, false> {
+    CountedSignal<float> origin_x;
+    CountedSignal<float> origin_y;
+    CountedSignal<float> origin_z;
+    CountedSignal<float> dir_x;
+    CountedSignal<float> dir_y;
+    CountedSignal<float> dir_z;
+    CountedSignal<float> tmax;
+    CountedSignal<int> tag;
+    CountedSignal<bool> any_hit;
+
+    void write(const Ray &ray) {
+        origin_x = ray.origin_x;
+        origin_y = ray.origin_y;
+        origin_z = ray.origin_z;
+        dir_x = ray.dir_x;
+        dir_y = ray.dir_y;
+        dir_z = ray.dir_z;
+        tmax = ray.tmax;
+        tag = ray.tag;
+        any_hit = ray.any_hit;
+    }
+
+    Ray read() const {
+        return Ray { origin_x, origin_y, origin_z, dir_x, dir_y, dir_z, tmax, tag, any_hit };
+    }
+};
+
+template<>
+struct Link<RayResult, false> {
+    CountedSignal<int> ray_id;
+    CountedSignal<int> tag;
+    CountedSignal<bool> hit;
+    CountedSignal<int> hit_trig_idx;
+    CountedSignal<int> hit_instance_idx;
+    CountedSignal<float> t;
+    CountedSignal<float> u;
+    CountedSignal<float> v;
+
+    void write(const RayResult &result) {
+        ray_id = result.ray_id;
+        tag = result.tag;
+        hit = result.hit;
+        hit_trig_idx = result.hit_trig_idx;
+        hit_instance_idx = result.hit_instance_idx;
+        t = result.t;
+        u = result.u;
+        v = result.v;
+    }
+
+    RayResult read() const {
+        return RayResult { ray_id, tag, hit, hit_trig_idx, hit_instance_idx, t, u, v };
+    }
+};
+
+// sends a ray per pixel, as RAYGEN does
+template<bool Packed>
+SC_MODULE(SOURCE) {
+    // high-level objects
+    sc_clock *clk;
+    CountedSignal<bool> *srstn;
+    CountedSignal<bool> *m_valid;
+    CountedSignal<bool> *m_ready;
+    Link<Ray, Packed> *m_ray;
+    int num_rays;
+
+    // internal signals
+    CountedSignal<int> pixel_idx;
+
+    SC_HAS_PROCESS(SOURCE);
+    SOURCE(const sc_module_name &mn, sc_clock *clk, CountedSignal<bool> *srstn, CountedSignal<bool> *m_valid,
+           CountedSignal<bool> *m_ready, Link<Ray, Packed> *m_ray, int num_rays)
+        : sc_module(mn), clk(clk), srstn(srstn), m_valid(m_valid), m_ready(m_ready), m_ray(m_ray),
+          num_rays(num_rays) {
+        SC_METHOD(main)
+        sensitive << clk->posedge_event();
+        dont_initialize();
+
+        SC_METHOD(update_m_valid)
+        sensitive << *srstn << pixel_idx;
+
+        SC_METHOD(update_m_ray)
+        sensitive << pixel_idx;
+    }
+
+    void main() {
+        activations++;
+        if (!*srstn) pixel_idx = 0;
+        else if (*m_valid && *m_ready) pixel_idx = pixel_idx + 1;
+    }
+
+    void update_m_valid() {
+        activations++;
+        *m_valid = (*srstn && pixel_idx < num_rays);
+    }
+
+    void update_m_ray() {
+        activations++;
+        int i = pixel_idx;
+        m_ray->write(Ray { 0.f, 0.1f, 1.f, -0.1f + 0.2f * (i % 256) / 256, 0.2f - 0.2f * (i / 256 % 256) / 256, -1.f,
+                           FLT_MAX, i, false });
+    }
+};
+
+// holds one ray and returns a result for it, with an output register as POST
+template<bool Packed>
+SC_MODULE(STAGE) {
+    // high-level objects
+    sc_clock *clk;
+    CountedSignal<bool> *srstn;
+    CountedSignal<bool> *s_valid;
+    CountedSignal<bool> *s_ready;
+    Link<Ray, Packed> *s_ray;
+    CountedSignal<bool> *m_valid;
+    CountedSignal<bool> *m_ready;
+    Link<RayResult, Packed> *m_result;
+
+    SC_HAS_PROCESS(STAGE);
+    STAGE(const sc_module_name &mn, sc_clock *clk, CountedSignal<bool> *srstn, CountedSignal<bool> *s_valid,
+          CountedSignal<bool> *s_ready, Link<Ray, Packed> *s_ray, CountedSignal<bool> *m_valid,
+          CountedSignal<bool> *m_ready, Link<RayResult, Packed> *m_result)
+        : sc_module(mn), clk(clk), srstn(srstn), s_valid(s_valid), s_ready(s_ready), s_ray(s_ray), m_valid(m_valid),
+          m_ready(m_ready), m_result(m_result) {
+        SC_METHOD(main)
+        sensitive << clk->posedge_event();
+        dont_initialize();
+
+        SC_METHOD(update_s_ready)
+        sensitive << *m_valid << *m_ready;
+    }
+
+    void main() {
+        activations++;
+        if (!*srstn) {
+            *m_valid = false;
+        } else {
+            bool m_valid_tmp = (*m_valid && !*m_ready);
+            if (*s_valid && *s_ready) {
+                Ray ray = s_ray->read();
+                float t = -ray.origin_z / ray.dir_z;
+                m_result->write(RayResult { ray.tag % 64, ray.tag, t < ray.tmax, ray.tag / 2, -1, t, ray.dir_x,
+                                            ray.dir_y });
+                m_valid_tmp = true;
+            }
+            *m_valid = m_valid_tmp;
+        }
+    }
+
+    void update_s_ready() {
+        activations++;
+        *s_ready = (!*m_valid || *m_ready);
+    }
+};
+
+// takes a result on 3 cycles out of 4, as a SHADER that stalls
+template<bool Packed>
+SC_MODULE(SINK) {
+    // high-level objects
+    sc_clock *clk;
+    CountedSignal<bool> *srstn;
+    CountedSignal<bool> *s_valid;
+    CountedSignal<bool> *s_ready;
+    Link<RayResult, Packed> *s_result;
+    long long rays;
+    double checksum;
+
+    // internal signals
+    CountedSignal<int> cycle;
+
+    SC_HAS_PROCESS(SINK);
+    SINK(const sc_module_name &mn, sc_clock *clk, CountedSignal<bool> *srstn, CountedSignal<bool> *s_valid,
+         CountedSignal<bool> *s_ready, Link<RayResult, Packed> *s_result)
+        : sc_module(mn), clk(clk), srstn(srstn), s_valid(s_valid), s_ready(s_ready), s_result(s_result), rays(0),
+          checksum(0.) {
+        SC_METHOD(main)
+        sensitive << clk->posedge_event();
+        dont_initialize();
+
+        SC_METHOD(update_s_ready)
+        sensitive << *srstn << cycle;
+    }
+
+    void main() {
+        activations++;
+        if (!*srstn) {
+            cycle = 0;
+        } else {
+            cycle = cycle + 1;
+            if (*s_valid && *s_ready) {
+                RayResult result = s_result->read();
+                rays++;
+                checksum += result.t + result.u * result.v + result.hit_trig_idx;
+            }
+        }
+    }
+
+    void update_s_ready() {
+        activations++;
+        *s_ready = (*srstn && cycle % 4 != 3);
+    }
+};
+
+template<bool Packed>
+void run(int num_rays) {
+    sc_clock clk("clk", 2, SC_PS);
+    CountedSignal<bool> srstn;
+    CountedSignal<bool> source_stage_valid;
+    CountedSignal<bool> source_stage_ready;
+    Link<Ray, Packed> source_stage_ray;
+    CountedSignal<bool> stage_sink_valid;
+    CountedSignal<bool> stage_sink_ready;
+    Link<RayResult, Packed> stage_sink_result;
+
+    SOURCE<Packed> source("source", &clk, &srstn, &source_stage_valid, &source_stage_ready, &source_stage_ray,
+                          num_rays);
+    STAGE<Packed> stage("stage", &clk, &srstn, &source_stage_valid, &source_stage_ready, &source_stage_ray,
+                        &stage_sink_valid, &stage_sink_ready, &stage_sink_result);
+    SINK<Packed> sink("sink", &clk, &srstn, &stage_sink_valid, &stage_sink_ready, &stage_sink_result);
+
+    srstn = false;
+    sc_start(4, SC_PS);
+    srstn = true;
+    long long base_updates = signal_updates;
+    long long base_activations = activations;
+    uint64_t base_deltas = sc_delta_count();
+
+    auto begin = std::chrono::steady_clock::now();
+    long long cycles = 0;
+    while (sink.rays < num_rays) {
+        sc_start(2 * 1024, SC_PS);
+        cycles += 1024;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - begin).count();
+
+    std::cout << (Packed ? "packed" : "fields") << '\t' << sink.rays << '\t' << cycles << '\t'
+              << double(signal_updates - base_updates) / sink.rays << '\t'
+              << double(activations - base_activations) / sink.rays << '\t'
+              << double(sc_delta_count() - base_deltas) / sink.rays << '\t' << seconds << '\t'
+              << sink.rays / seconds << '\t' << sink.checksum << std::endl;
+}
+
+int sc_main(int argc, char *argv[]) {
+    int num_rays = argc > 1 ? std::atoi(argv[1]) : 1000000;
+
+    std::cout << "layout\trays\tcycles\tupdates_per_ray\tactivations_per_ray\tdeltas_per_ray\tseconds\trays_per_s"
+                 "\tchecksum" << std::endl;
+    for (bool packed : { false, true }) {
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (packed) run<true>(num_rays);
+            else run<false>(num_rays);
+            std::cout.flush();
+            _exit(0);
+        }
+        int status;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cerr << "Run failed" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include <systemc>
+using namespace sc_core;
+using namespace sc_dt;
+
+#include "../custom_structs/perf_counters.hpp"
+#include "../modules/rtcore/fifos/fifo.hpp"
+
+// simulation speed of FIFO against a FIFO keeping its slots in signals, whose output methods are sensitive to every
+// slot, as RD_POST_FIFO and LIST_FIFO did. The producer pushes for depth cycles and the consumer then pops for depth
+// cycles, so the FIFO goes from empty to full and back. Each run is a separate process, so the kernel starts afresh.
+// usage: bench-fifo [num_cycles]
+
+template<int MaxDepth>
+SC_MODULE(SIGNAL_FIFO) {
+    // ports
+    sc_in<bool> s_valid;
+    sc_out<bool> s_ready;
+    sc_in<int> s_entry;
+
+    sc_in<bool> clk;
+    sc_in<bool> srstn;
+
+    sc_out<bool> m_valid;
+    sc_in<bool> m_ready;
+    sc_out<int> m_entry;
+
+    // internal states
+    sc_signal<int> entries[MaxDepth + 1];
+    sc_signal<int> front;
+    sc_signal<int> back;
+
+    // performance counters
+    std::vector<long long> *occupancy;  // cycles spent with each number of entries
+
+    SC_CTOR(SIGNAL_FIFO) {
+        occupancy = &PerfCounters::get().histogram(name(), "occupancy", MaxDepth + 1);
+
+        SC_METHOD(main)
+        sensitive << clk.pos();
+        dont_initialize();
+
+        SC_METHOD(update_s_ready)
+        sensitive << front << back;
+
+        SC_METHOD(update_m_valid)
+        sensitive << front << back;
+
+        SC_METHOD(update_m_entry)
+        for (int i = 0; i <= MaxDepth; i++) sensitive << entries[i];
+        sensitive << front;
+    }
+
+    void main() {
+        if (!srstn) {
+            front = 0;
+            back = 0;
+        } else {
+            (*occupancy)[(back - front + MaxDepth + 1) % (MaxDepth + 1)]++;
+
+            if (s_valid && s_ready) {
+                entries[back] = s_entry;
+                back = (back + 1) % (MaxDepth + 1);
+            }
+            if (m_valid && m_ready) {
+                front = (front + 1) % (MaxDepth + 1);
+            }
+        }
+    }
+
+    void update_s_ready() {
+        s_ready = ((back + 1) % (MaxDepth + 1) != front);
+    }
+
+    void update_m_valid() {
+        m_valid = (front != back);
+    }
+
+    void update_m_entry() {
+        m_entry = entries[front];
+    }
+};
+
+// pushes 0, 1, 2, ... in the first half of every 2 * depth cycles and pops in the second half, checking the order
+SC_MODULE(DRIVER) {
+    // ports
+    sc_in<bool> clk;
+    sc_in<bool> srstn;
+
+    sc_out<bool> m_valid;
+    sc_in<bool> m_ready;
+    sc_out<int> m_entry;
+
+    sc_in<bool> s_valid;
+    sc_out<bool> s_ready;
+    sc_in<int> s_entry;
+
+    // high-level objects
+    int depth;
+
+    // internal states
+    long long cycle;
+    int pushed;
+    int popped;
+    int errors;
+
+    SC_HAS_PROCESS(DRIVER);
+    DRIVER(const sc_module_name &mn, int depth)
+        : sc_module(mn), depth(depth), cycle(0), pushed(0), popped(0), errors(0) {
+        SC_METHOD(main)
+        sensitive << clk.pos();
+        dont_initialize();
+    }
+
+    void main() {
+        if (!srstn) {
+            m_valid = false;
+            s_ready = false;
+            return;
+        }
+        if (m_valid && m_ready) pushed++;
+        if (s_valid && s_ready) {
+            if (s_entry != popped) errors++;
+            popped++;
+        }
+        bool push_phase = (cycle++ / depth % 2 == 0);
+        m_valid = push_phase;
+        m_entry = pushed;
+        s_ready = !push_phase;
+    }
+};
+
+template<typename Fifo>
+void run(const char *layout, int depth, long long num_cycles) {
+    sc_clock clk("clk", 2, SC_PS);
+    sc_signal<bool> srstn;
+    sc_signal<bool> s_valid;
+    sc_signal<bool> s_ready;
+    sc_signal<int> s_entry;
+    sc_signal<bool> m_valid;
+    sc_signal<bool> m_ready;
+    sc_signal<int> m_entry;
+
+    Fifo fifo("fifo");
+    fifo.s_valid(s_valid);
+    fifo.s_ready(s_ready);
+    fifo.s_entry(s_entry);
+    fifo.clk(clk);
+    fifo.srstn(srstn);
+    fifo.m_valid(m_valid);
+    fifo.m_ready(m_ready);
+    fifo.m_entry(m_entry);
+
+    DRIVER driver("driver", depth);
+    driver.clk(clk);
+    driver.srstn(srstn);
+    driver.m_valid(s_valid);
+    driver.m_ready(s_ready);
+    driver.m_entry(s_entry);
+    driver.s_valid(m_valid);
+    driver.s_ready(m_ready);
+    driver.s_entry(m_entry);
+
+    srstn = false;
+    sc_start(4, SC_PS);
+    srstn = true;
+    uint64_t base_deltas = sc_delta_count();
+
+    auto begin = std::chrono::steady_clock::now();
+    sc_start(2 * num_cycles, SC_PS);
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - begin).count();
+
+    std::cout << depth << '\t' << layout << '\t' << num_cycles << '\t' << driver.popped << '\t' << driver.errors << '\t'
+              << double(sc_delta_count() - base_deltas) / num_cycles << '\t' << seconds << '\t'
+              << num_cycles / seconds << std::endl;
+}
+
+// runs fn in a child process, false when it failed
+template<typename F>
+bool forked(F fn) {
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        fn();
+        std::cout.flush();
+        _exit(0);
+    }
+    int status;
+    return pid >= 0 && waitpid(pid, &status, 0) >= 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+template<int... Depths>
+bool run_all(long long num_cycles) {
+    return ((forked([&]() { run<SIGNAL_FIFO<Depths>>("signal", Depths, num_cycles); }) &&
+             forked([&]() { run<FIFO<int, Depths>>("array", Depths, num_cycles); })) && ...);
+}
+
+int sc_main(int argc, char *argv[]) {
+    long long num_cycles = argc > 1 ? std::atoll(argv[1]) : 1000000;
+
+    std::cout << "depth\tlayout\tcycles\tpopped\terrors\tdeltas_per_cycle\tseconds\tcycles_per_s" << std::endl;
+    if (!run_all<4, 16, 64, 256, 1024>(num_cycles)) {
+        std::cerr << "Run failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -2,6 +2,7 @@
 #define RTCORE_SYSTEMC_BOUNDING_BOX_HPP
 
 #include <cfloat>
+#include <algorithm>
 
 struct BoundingBox {
     BoundingBox() { }
@@ -18,12 +19,12 @@ struct BoundingBox {
 };
 
 void BoundingBox::extend(const BoundingBox &other) {
-    bounds[0] = fminf(bounds[0], other.bounds[0]);
-    bounds[1] = fmaxf(bounds[1], other.bounds[1]);
-    bounds[2] = fminf(bounds[2], other.bounds[2]);
-    bounds[3] = fmaxf(bounds[3], other.bounds[3]);
-    bounds[4] = fminf(bounds[4], other.bounds[4]);
-    bounds[5] = fmaxf(bounds[5], other.bounds[5]);
+    bounds[0] = std::min(bounds[0], other.bounds[0]);
+    bounds[1] = std::max(bounds[1], other.bounds[1]);
+    bounds[2] = std::min(bounds[2], other.bounds[2]);
+    bounds[3] = std::max(bounds[3], other.bounds[3]);
+    bounds[4] = std::min(bounds[4], other.bounds[4]);
+    bounds[5] = std::max(bounds[5], other.bounds[5]);
 }
 
 float BoundingBox::half_area() const {
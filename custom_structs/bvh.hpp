@@ -1,51 +1,161 @@
 #ifndef RTCORE_SYSTEMC_BVH_HPP
 #define RTCORE_SYSTEMC_BVH_HPP
 
+#include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <numeric>
 #include <algorithm>
 #include <stack>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include "triangle.hpp"
 #include "bounding_box.hpp"
 
 struct Bvh {
+    static const int BVH_MAX_DEPTH = 30;
+    static const int MAX_WIDTH = 8;  // widest node produced by collapse()
+
     struct Node {
         bool is_leaf() const { return num_trigs > 0; }
+        bool is_instance() const { return num_trigs == 0 && left_node_idx < 0; }  // leaf of a TLAS
+        int instance_idx() const { return -1 - left_node_idx; }
 
         BoundingBox bbox;
         int num_trigs;  // 0 when node != leaf
         union {
-            int left_node_idx;  // used when node != leaf
+            int left_node_idx;  // used when node != leaf, -1 - instance index for an instance node
             int first_trig_idx;  // used when node == leaf
         };
     };
 
-    Bvh(const std::vector<Triangle> &unsorted_triangles);
+    // child boxes of an inner node quantized to 8 bits per bound relative to the union of the children,
+    // bound = origin + q * 2^exponent, rounded outwards so that a decoded box always contains the exact one
+    struct QuantizedNode {
+        float decode(int axis, int q) const { return origin[axis] + ldexpf(q, exponent[axis]); }
+        BoundingBox child_bbox(int i) const;
+        bool is_leaf(int i) const { return num_trigs[i] > 0; }
 
-    static const int BVH_MAX_DEPTH = 30;
+        // bytes of a record with width children: origin, exponents and a padding byte, then 6 + 8 bytes per child
+        static int bytes(int width) { return 16 + 14 * width; }
+
+        float origin[3];
+        int8_t exponent[3];
+        uint8_t q_bounds[MAX_WIDTH][6];  // [xmin, xmax, ymin, ymax, zmin, zmax], min > max for padding
+        int num_trigs[MAX_WIDTH];
+        int child_idx[MAX_WIDTH];  // left_node_idx of inner children, first_trig_idx of leaves
+    };
+
+    // a BLAS placed in the world by an affine transform, stored as the top 3 rows of a row-major 4x4 matrix
+    struct Instance {
+        Instance() { }
+        Instance(const float transform[12], int blas_idx);
+
+        // w = 1 for points, 0 for directions. Directions are not normalized, so distances along a ray are the same
+        // in world and object space
+        static Vec3 apply(const float m[12], const Vec3 &p, float w) {
+            return Vec3(m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3] * w,
+                        m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7] * w,
+                        m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11] * w);
+        }
+
+        float to_world[12];
+        float to_object[12];
+        int blas_idx;  // index in the blases passed to instance()
+        int left_node_idx;  // first child of the BLAS root in nodes
+        int first_trig_idx;  // triangles of the BLAS
+        int num_trigs;
+    };
+
+    enum class BuildMethod {
+        SWEEP,  // full sweep over presorted references, single-threaded
+        BINNED  // binned SAH, subtrees are built in parallel
+    };
+
+    Bvh() { }
+    Bvh(const std::vector<Triangle> &unsorted_triangles, BuildMethod build_method = BuildMethod::SWEEP);
+
+    float sah_cost() const;
+
+    // updates the boxes bottom-up after the triangles moved in place, keeping the topology, and returns the new SAH
+    // cost. Near the root, every child but the last is refit on another thread while the current one refits the last,
+    // with the task budget of the binned builder. Two-level BVHs are not supported: instance nodes have no triangles
+    float refit();
+
+    // refits, or rebuilds from the moved triangles once the SAH cost exceeds max_sah_growth times the cost of the last
+    // build: refit boxes only grow apart as the triangles move. A rebuild reorders the triangles and keeps the width.
+    // Returns true when the BVH was rebuilt. A two-level BVH is left unchanged, with an error message
+    bool update(float max_sah_growth, BuildMethod build_method);
+
+    // wide BVH with up to width children per inner node. The children of an inner node are stored contiguously at
+    // [left_node_idx, left_node_idx + width), padded with empty nodes that are never hit, so TRV fetches and tests
+    // fixed-size groups like the sibling pairs of the binary BVH. Triangles are shared with this BVH.
+    Bvh collapse(int width) const;
+
+    // builds quantized_nodes. The child group at left_node_idx is described by quantized_nodes[(left_node_idx - 1) / width]
+    void quantize();
+
+    // builds parents, for traversal that backtracks instead of keeping a full stack
+    void link_parents();
+
+    // two-level BVH: a TLAS over the instances followed by the nodes of every BLAS, without their roots, so that
+    // child groups stay aligned. Each TLAS leaf is an instance node, and the triangles of a BLAS are stored once
+    // however many instances refer to it. The BLASes must have the same width and at least two instances are needed,
+    // since TRV expects an inner root.
+    static Bvh instance(const std::vector<const Bvh *> &blases, std::vector<Instance> instances);
+
+    // geometric normal in world space of a triangle hit in an instance, -1 without instancing, not normalized
+    Vec3 world_normal(int instance_idx, int trig_idx) const;
+    static const int NUM_BINS = 32;  // bins per axis used by the binned builder
+    static const int PARALLEL_MIN_TRIGS = 4096;  // smaller subtrees are built on the current thread
+    static const int PARALLEL_REFIT_DEPTH = 6;  // deeper subtrees are refit on the current thread
 
     int num_triangles;
     Triangle *triangles;
     int num_nodes;
     Node *nodes;
+    int width = 2;  // children per inner node
+    int num_quantized_nodes = 0;
+    QuantizedNode *quantized_nodes = nullptr;  // nullptr unless quantize() was called
+    float built_sah_cost = 0.f;  // SAH cost after the last build, 0 until update() is called on a loaded BVH
+    int *parents = nullptr;  // parent node of each child group, indexed like quantized_nodes, nullptr unless link_parents() was called
+    int num_instances = 0;
+    Instance *instances = nullptr;  // nullptr unless built by instance()
+
+    // owners of the arrays above, shared by copies of the BVH, so reassigning one frees what no other copy uses.
+    // collapse() shares the triangles, and a BVH loaded from the cache has both owned by the mapping
+    std::shared_ptr<void> triangles_storage;
+    std::shared_ptr<void> nodes_storage;
+    std::shared_ptr<void> quantized_nodes_storage;
+    std::shared_ptr<void> parents_storage;
+    std::shared_ptr<void> instances_storage;
+
+private:
+    // array of n elements, freed with the last copy of owner
+    template<typename T>
+    static T *allocate(int n, std::shared_ptr<void> &owner) {
+        T *data = new T[n];
+        owner = std::shared_ptr<T[]>(data);
+        return data;
+    }
+
+    int build_sweep(const BoundingBox *bboxes, const Vec3 *centers, Node *tmp_nodes, int *references);
+    int build_binned(const BoundingBox *bboxes, const Vec3 *centers, Node *tmp_nodes, int *references);
 };
 
 // construct BVH
-Bvh::Bvh(const std::vector<Triangle> &unsorted_triangles) : num_triangles(unsorted_triangles.size()) {
+Bvh::Bvh(const std::vector<Triangle> &unsorted_triangles, BuildMethod build_method)
+    : num_triangles(unsorted_triangles.size()) {
     // allocate temporary memory for BVH construction
     auto bboxes = std::make_unique<BoundingBox[]>(num_triangles);
     auto centers = std::make_unique<Vec3[]>(num_triangles);
-    auto costs = std::make_unique<float[]>(num_triangles);
-    auto marks = std::make_unique<bool[]>(num_triangles);
-    auto sorted_references_data = std::make_unique<int[]>(3 * num_triangles);
-    int *sorted_references[3] = { sorted_references_data.get(),
-                                  sorted_references_data.get() + num_triangles,
-                                  sorted_references_data.get() + 2 * num_triangles };
+    auto references = std::make_unique<int[]>(num_triangles);
     auto tmp_nodes = std::make_unique<Node[]>(2 * num_triangles);
-    triangles = new Triangle[num_triangles];
-
-    // initially, there is only one node
-    num_nodes = 1;
-    int max_depth = 0;
+    triangles = allocate<Triangle>(num_triangles, triangles_storage);
 
     // initialize bboxes, centers, and tmp_nodes[0].bbox
     tmp_nodes[0].bbox.reset();
@@ -63,6 +173,387 @@ Bvh::Bvh(const std::vector<Triangle> &unsorted_triangles) : num_triangles(unsort
               << tmp_nodes[0].bbox.bounds[3] << ", "
               << tmp_nodes[0].bbox.bounds[5] << ") " << std::endl;
 
+    auto build_begin = std::chrono::steady_clock::now();
+    int max_depth;
+    if (build_method == BuildMethod::SWEEP)
+        max_depth = build_sweep(bboxes.get(), centers.get(), tmp_nodes.get(), references.get());
+    else
+        max_depth = build_binned(bboxes.get(), centers.get(), tmp_nodes.get(), references.get());
+    auto build_end = std::chrono::steady_clock::now();
+
+    std::cout << "BVH has " << num_nodes << " nodes and " << num_triangles
+              << " triangles, with max_depth = " << max_depth << std::endl;
+
+    // rearrange primitives based on references
+    for (int i = 0; i < num_triangles; i++) triangles[i] = unsorted_triangles[references[i]];
+
+    // copy nodes to device
+    nodes = allocate<Node>(num_nodes, nodes_storage);
+    std::copy(tmp_nodes.get(), tmp_nodes.get() + num_nodes, nodes);
+
+    built_sah_cost = sah_cost();
+    std::cout << (build_method == BuildMethod::SWEEP ? "Sweep" : "Binned") << " SAH builder took "
+              << std::chrono::duration<double, std::milli>(build_end - build_begin).count()
+              << " ms, SAH cost = " << built_sah_cost << std::endl;
+}
+
+// SAH cost of the whole tree, with unit traversal and intersection costs and areas relative to the root
+float Bvh::sah_cost() const {
+    double root_area = nodes[0].bbox.half_area();
+    double cost = 0.0;
+    for (int i = 0; i < num_nodes; i++) {
+        if (nodes[i].bbox.bounds[0] > nodes[i].bbox.bounds[1]) continue;  // padding of a wide node
+        double area = nodes[i].bbox.half_area() / root_area;
+        cost += nodes[i].is_leaf() ? area * nodes[i].num_trigs : area;
+    }
+    return cost;
+}
+
+float Bvh::refit() {
+    assert(!instances);
+    std::atomic<int> num_tasks(0);
+    int max_tasks = std::max(1, (int)std::thread::hardware_concurrency()) - 1;
+
+    std::function<void(int, int)> refit_node = [&](int node_idx, int depth) {
+        Node &node = nodes[node_idx];
+        node.bbox.reset();
+        if (node.is_leaf()) {
+            for (int i = node.first_trig_idx; i < node.first_trig_idx + node.num_trigs; i++)
+                node.bbox.extend(triangles[i].bounding_box());
+            return;
+        }
+
+        // padding of a wide node keeps its empty box
+        std::vector<int> children;
+        for (int i = node.left_node_idx; i < node.left_node_idx + width; i++) {
+            if (nodes[i].is_leaf() || nodes[i].left_node_idx != 0) children.push_back(i);
+        }
+
+        // spawn every task before refitting on this thread, so the last child overlaps with its siblings
+        std::vector<std::future<void>> tasks;
+        std::vector<int> local_children;
+        for (int c = 0; c < (int)children.size(); c++) {
+            int i = children[c];
+            bool spawn_task = false;
+            if (depth < PARALLEL_REFIT_DEPTH && c + 1 < (int)children.size()) {
+                if (num_tasks.fetch_add(1) < max_tasks) spawn_task = true;
+                else num_tasks--;
+            }
+            if (spawn_task) {
+                tasks.push_back(std::async(std::launch::async, [&, i]() {
+                    refit_node(i, depth + 1);
+                    num_tasks--;
+                }));
+            } else {
+                local_children.push_back(i);
+            }
+        }
+        for (int i : local_children) refit_node(i, depth + 1);
+        for (std::future<void> &task : tasks) task.get();
+        for (int i = node.left_node_idx; i < node.left_node_idx + width; i++) node.bbox.extend(nodes[i].bbox);
+    };
+    refit_node(0, 0);
+
+    // quantized boxes are relative to the boxes of the children
+    if (quantized_nodes) quantize();
+    return sah_cost();
+}
+
+bool Bvh::update(float max_sah_growth, BuildMethod build_method) {
+    if (instances) {
+        // a rebuild from the triangles would flatten the instances
+        std::cerr << "Bvh::update does not support two-level BVHs" << std::endl;
+        return false;
+    }
+    if (built_sah_cost == 0.f) built_sah_cost = sah_cost();
+    if (refit() <= max_sah_growth * built_sah_cost) return false;
+
+    std::cout << "SAH cost grew from " << built_sah_cost << " to " << sah_cost() << ", rebuilding" << std::endl;
+    Bvh rebuilt(std::vector<Triangle>(triangles, triangles + num_triangles), build_method);
+    if (width > 2) {
+        rebuilt = rebuilt.collapse(width);
+        rebuilt.built_sah_cost = rebuilt.sah_cost();
+    }
+    if (quantized_nodes) rebuilt.quantize();
+    if (parents) rebuilt.link_parents();
+    *this = std::move(rebuilt);
+    return true;
+}
+
+// greedy collapse: the inner child with the largest surface area is replaced by its children until the node is full
+Bvh Bvh::collapse(int width) const {
+    Bvh wide;
+    wide.width = width;
+    wide.num_triangles = num_triangles;
+    wide.triangles = triangles;
+    wide.triangles_storage = triangles_storage;
+    wide.num_instances = num_instances;
+    wide.instances = instances;
+    wide.instances_storage = instances_storage;
+
+    std::vector<Node> wide_nodes(1, nodes[0]);
+    int max_depth = 0;
+    std::stack<std::array<int, 3>> stack;  // wide node_idx, binary node_idx, depth
+    stack.push({ 0, 0, 0 });
+    while (!stack.empty()) {
+        auto [wide_node_idx, node_idx, depth] = stack.top();
+        stack.pop();
+        max_depth = std::max(max_depth, depth);
+        if (nodes[node_idx].is_leaf() || nodes[node_idx].is_instance()) continue;
+
+        std::vector<int> children = { nodes[node_idx].left_node_idx, nodes[node_idx].left_node_idx + 1 };
+        while ((int)children.size() < width) {
+            int largest = -1;
+            for (int i = 0; i < (int)children.size(); i++) {
+                if (nodes[children[i]].is_leaf() || nodes[children[i]].is_instance()) continue;
+                if (largest == -1 || nodes[children[i]].bbox.half_area() > nodes[children[largest]].bbox.half_area())
+                    largest = i;
+            }
+            if (largest == -1) break;
+            int left_node_idx = nodes[children[largest]].left_node_idx;
+            children[largest] = left_node_idx;
+            children.insert(children.begin() + largest + 1, left_node_idx + 1);
+        }
+
+        int first_child_idx = wide_nodes.size();
+        wide_nodes[wide_node_idx].left_node_idx = first_child_idx;
+        for (int i = 0; i < width; i++) {
+            if (i < (int)children.size()) {
+                wide_nodes.push_back(nodes[children[i]]);
+                stack.push({ first_child_idx + i, children[i], depth + 1 });
+            } else {
+                Node padding;
+                padding.bbox.reset();
+                padding.num_trigs = 0;
+                padding.left_node_idx = 0;
+                wide_nodes.push_back(padding);
+            }
+        }
+    }
+
+    wide.num_nodes = wide_nodes.size();
+    wide.nodes = allocate<Node>(wide.num_nodes, wide.nodes_storage);
+    std::copy(wide_nodes.begin(), wide_nodes.end(), wide.nodes);
+
+    std::cout << "Collapsed to a " << width << "-wide BVH with " << wide.num_nodes << " nodes, with max_depth = "
+              << max_depth << ", SAH cost = " << wide.sah_cost() << std::endl;
+    return wide;
+}
+
+BoundingBox Bvh::QuantizedNode::child_bbox(int i) const {
+    const uint8_t *q = q_bounds[i];
+    if (q[0] > q[1]) return BoundingBox::Empty();
+    return BoundingBox(decode(0, q[0]), decode(0, q[1]), decode(1, q[2]), decode(1, q[3]), decode(2, q[4]), decode(2, q[5]));
+}
+
+void Bvh::quantize() {
+    num_quantized_nodes = (num_nodes - 1) / width;
+    quantized_nodes = allocate<QuantizedNode>(num_quantized_nodes, quantized_nodes_storage);
+    for (int i = 0; i < num_quantized_nodes; i++) {
+        QuantizedNode &qnode = quantized_nodes[i];
+        const Node *children = nodes + 1 + i * width;
+        BoundingBox bbox = BoundingBox::Empty();
+        for (int j = 0; j < width; j++) bbox.extend(children[j].bbox);
+
+        // decoding rounds, so bounds are moved outwards until they contain the exact ones, with a coarser
+        // exponent when that does not fit in 8 bits
+        auto quantize_axis = [&](int axis, int exponent) {
+            qnode.exponent[axis] = exponent;
+            for (int j = 0; j < width; j++) {
+                const float *bounds = children[j].bbox.bounds;
+                uint8_t *q = qnode.q_bounds[j];
+                if (bounds[0] > bounds[1]) {
+                    q[2 * axis] = 255;
+                    q[2 * axis + 1] = 0;
+                    continue;
+                }
+                float scale = ldexpf(1.f, exponent);
+                int q_min = std::clamp((int)floorf((bounds[2 * axis] - qnode.origin[axis]) / scale), 0, 255);
+                int q_max = std::clamp((int)ceilf((bounds[2 * axis + 1] - qnode.origin[axis]) / scale), 0, 255);
+                while (q_min > 0 && qnode.decode(axis, q_min) > bounds[2 * axis]) q_min--;
+                while (q_max < 255 && qnode.decode(axis, q_max) < bounds[2 * axis + 1]) q_max++;
+                if (qnode.decode(axis, q_min) > bounds[2 * axis] || qnode.decode(axis, q_max) < bounds[2 * axis + 1])
+                    return false;
+                q[2 * axis] = q_min;
+                q[2 * axis + 1] = q_max;
+            }
+            return true;
+        };
+        for (int axis = 0; axis < 3; axis++) {
+            qnode.origin[axis] = bbox.bounds[2 * axis];
+            int exponent;
+            frexpf((bbox.bounds[2 * axis + 1] - bbox.bounds[2 * axis]) / 255.f, &exponent);
+            while (!quantize_axis(axis, exponent)) exponent++;
+        }
+
+        for (int j = 0; j < width; j++) {
+            qnode.num_trigs[j] = children[j].num_trigs;
+            qnode.child_idx[j] = children[j].left_node_idx;
+        }
+    }
+
+    std::cout << "Quantized " << num_quantized_nodes << " nodes to " << QuantizedNode::bytes(width)
+              << " bytes per node instead of " << width * sizeof(Node) << std::endl;
+}
+
+void Bvh::link_parents() {
+    parents = allocate<int>((num_nodes - 1) / width, parents_storage);
+    for (int i = 0; i < num_nodes; i++) {
+        // neither have padding of a wide node and instance nodes
+        if (nodes[i].is_leaf() || nodes[i].left_node_idx <= 0) continue;
+        parents[(nodes[i].left_node_idx - 1) / width] = i;
+    }
+}
+
+Bvh::Instance::Instance(const float transform[12], int blas_idx) : blas_idx(blas_idx) {
+    std::copy(transform, transform + 12, to_world);
+
+    // inverse of the linear part by cofactors, then the translation is undone
+    const float *m = to_world;
+    float cofactors[9] = {
+        m[5] * m[10] - m[6] * m[9], m[2] * m[9] - m[1] * m[10], m[1] * m[6] - m[2] * m[5],
+        m[6] * m[8] - m[4] * m[10], m[0] * m[10] - m[2] * m[8], m[2] * m[4] - m[0] * m[6],
+        m[4] * m[9] - m[5] * m[8], m[1] * m[8] - m[0] * m[9], m[0] * m[5] - m[1] * m[4]
+    };
+    float inv_det = 1.f / (m[0] * cofactors[0] + m[1] * cofactors[3] + m[2] * cofactors[6]);
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++) to_object[4 * row + col] = cofactors[3 * row + col] * inv_det;
+        to_object[4 * row + 3] = -(to_object[4 * row] * m[3] + to_object[4 * row + 1] * m[7]
+                                   + to_object[4 * row + 2] * m[11]);
+    }
+}
+
+Vec3 Bvh::world_normal(int instance_idx, int trig_idx) const {
+    const Vec3 &n = triangles[trig_idx].n;
+    if (instance_idx < 0) return n;
+
+    // normals are transformed by the transposed inverse
+    const float *m = instances[instance_idx].to_object;
+    return Vec3(m[0] * n.x + m[4] * n.y + m[8] * n.z,
+                m[1] * n.x + m[5] * n.y + m[9] * n.z,
+                m[2] * n.x + m[6] * n.y + m[10] * n.z);
+}
+
+Bvh Bvh::instance(const std::vector<const Bvh *> &blases, std::vector<Instance> instances) {
+    Bvh scene;
+    scene.width = blases[0]->width;
+    scene.num_instances = instances.size();
+
+    // world boxes of the instances, from the corners of the BLAS roots
+    std::vector<BoundingBox> bboxes(instances.size());
+    std::vector<Vec3> centers(instances.size());
+    for (int i = 0; i < (int)instances.size(); i++) {
+        const float *bounds = blases[instances[i].blas_idx]->nodes[0].bbox.bounds;
+        bboxes[i].reset();
+        for (int corner = 0; corner < 8; corner++) {
+            Vec3 p(bounds[corner & 1], bounds[2 + (corner >> 1 & 1)], bounds[4 + (corner >> 2)]);
+            Vec3 q = Instance::apply(instances[i].to_world, p, 1.f);
+            bboxes[i].extend(BoundingBox(q.x, q.x, q.y, q.y, q.z, q.z));
+        }
+        centers[i] = Vec3((bboxes[i].bounds[0] + bboxes[i].bounds[1]) / 2.f,
+                          (bboxes[i].bounds[2] + bboxes[i].bounds[3]) / 2.f,
+                          (bboxes[i].bounds[4] + bboxes[i].bounds[5]) / 2.f);
+    }
+
+    // binary TLAS with one instance per leaf, split at the median of the widest axis of the centers. There are few
+    // instances, so the split does not need to be as good as for triangles
+    Bvh tlas;
+    tlas.num_triangles = 0;
+    tlas.triangles = nullptr;
+    std::vector<Node> tlas_nodes(1);
+    std::vector<int> references(instances.size());
+    std::iota(references.begin(), references.end(), 0);
+    std::stack<std::array<int, 3>> stack;  // node_idx, begin, end
+    stack.push({ 0, 0, (int)instances.size() });
+    while (!stack.empty()) {
+        auto [node_idx, begin, end] = stack.top();
+        stack.pop();
+        tlas_nodes[node_idx].bbox.reset();
+        for (int i = begin; i < end; i++) tlas_nodes[node_idx].bbox.extend(bboxes[references[i]]);
+        tlas_nodes[node_idx].num_trigs = 0;
+        if (end - begin == 1) {
+            tlas_nodes[node_idx].left_node_idx = -1 - references[begin];
+            continue;
+        }
+
+        BoundingBox center_bbox = BoundingBox::Empty();
+        for (int i = begin; i < end; i++) {
+            const Vec3 &c = centers[references[i]];
+            center_bbox.extend(BoundingBox(c.x, c.x, c.y, c.y, c.z, c.z));
+        }
+        const float *bounds = center_bbox.bounds;
+        int axis = 0;
+        for (int j = 1; j < 3; j++) {
+            if (bounds[2 * j + 1] - bounds[2 * j] > bounds[2 * axis + 1] - bounds[2 * axis]) axis = j;
+        }
+        auto coord = [&](int i) { return axis == 0 ? centers[i].x : (axis == 1 ? centers[i].y : centers[i].z); };
+        int mid = (begin + end) / 2;
+        std::nth_element(references.begin() + begin, references.begin() + mid, references.begin() + end,
+                         [&](int i, int j) { return coord(i) < coord(j); });
+
+        int left_node_index = tlas_nodes.size();
+        tlas_nodes[node_idx].left_node_idx = left_node_index;
+        tlas_nodes.resize(tlas_nodes.size() + 2);
+        stack.push({ left_node_index + 1, mid, end });
+        stack.push({ left_node_index, begin, mid });
+    }
+    tlas.num_nodes = tlas_nodes.size();
+    tlas.nodes = tlas_nodes.data();
+    if (scene.width > 2) tlas = tlas.collapse(scene.width);
+
+    // the BLASes follow the TLAS, their triangles are appended once each
+    std::vector<int> node_offsets(blases.size());
+    std::vector<int> trig_offsets(blases.size());
+    scene.num_nodes = tlas.num_nodes;
+    scene.num_triangles = 0;
+    for (int b = 0; b < (int)blases.size(); b++) {
+        node_offsets[b] = scene.num_nodes - 1;
+        trig_offsets[b] = scene.num_triangles;
+        scene.num_nodes += blases[b]->num_nodes - 1;
+        scene.num_triangles += blases[b]->num_triangles;
+    }
+    scene.nodes = allocate<Node>(scene.num_nodes, scene.nodes_storage);
+    scene.triangles = allocate<Triangle>(scene.num_triangles, scene.triangles_storage);
+    std::copy(tlas.nodes, tlas.nodes + tlas.num_nodes, scene.nodes);
+    for (int b = 0; b < (int)blases.size(); b++) {
+        const Bvh *blas = blases[b];
+        for (int i = 1; i < blas->num_nodes; i++) {
+            Node node = blas->nodes[i];
+            if (node.is_leaf()) node.first_trig_idx += trig_offsets[b];
+            else if (node.left_node_idx != 0) node.left_node_idx += node_offsets[b];  // not padding
+            scene.nodes[node_offsets[b] + i] = node;
+        }
+        std::copy(blas->triangles, blas->triangles + blas->num_triangles, scene.triangles + trig_offsets[b]);
+    }
+
+    for (Instance &inst : instances) {
+        const Bvh *blas = blases[inst.blas_idx];
+        inst.left_node_idx = blas->nodes[0].left_node_idx + node_offsets[inst.blas_idx];
+        inst.first_trig_idx = trig_offsets[inst.blas_idx];
+        inst.num_trigs = blas->num_triangles;
+    }
+    scene.instances = allocate<Instance>(scene.num_instances, scene.instances_storage);
+    std::copy(instances.begin(), instances.end(), scene.instances);
+
+    std::cout << "Instanced " << blases.size() << " BLAS(es) " << scene.num_instances << " times, TLAS has "
+              << tlas.num_nodes << " nodes, " << scene.num_nodes << " nodes and " << scene.num_triangles
+              << " triangles in total" << std::endl;
+    return scene;
+}
+
+// sweep over all split positions of all three axes, keeping the references presorted on each axis
+int Bvh::build_sweep(const BoundingBox *bboxes, const Vec3 *centers, Node *tmp_nodes, int *references) {
+    auto costs = std::make_unique<float[]>(num_triangles);
+    auto marks = std::make_unique<bool[]>(num_triangles);
+    auto sorted_references_data = std::make_unique<int[]>(3 * num_triangles);
+    int *sorted_references[3] = { sorted_references_data.get(),
+                                  sorted_references_data.get() + num_triangles,
+                                  sorted_references_data.get() + 2 * num_triangles };
+
+    // initially, there is only one node
+    num_nodes = 1;
+    int max_depth = 0;
+
     // sort on x-coordinate
     std::iota(sorted_references[0], sorted_references[0] + num_triangles, 0);
     std::sort(sorted_references[0], sorted_references[0] + num_triangles,
@@ -190,15 +681,171 @@ Bvh::Bvh(const std::vector<Triangle> &unsorted_triangles) : num_triangles(unsort
         }
     }
 
-    std::cout << "BVH has " << num_nodes << " nodes and " << num_triangles
-              << " triangles, with max_depth = " << max_depth << std::endl;
+    std::copy(sorted_references[0], sorted_references[0] + num_triangles, references);
+    return max_depth;
+}
 
-    // rearrange primitives based on sorted_references
-    for (int i = 0; i < num_triangles; i++) triangles[i] = unsorted_triangles[sorted_references[0][i]];
+// bin triangle centers on every axis and split at the cheapest bin boundary; large subtrees become parallel tasks
+int Bvh::build_binned(const BoundingBox *bboxes, const Vec3 *centers, Node *tmp_nodes, int *references) {
+    std::iota(references, references + num_triangles, 0);
 
-    // copy nodes to device
-    nodes = new Node[num_nodes];
-    std::copy(tmp_nodes.get(), tmp_nodes.get() + num_nodes, nodes);
+    // nodes are allocated concurrently, so their order depends on thread timing until they are renumbered below
+    std::atomic<int> num_tmp_nodes(1);
+    std::atomic<int> max_depth(0);
+    std::atomic<int> num_tasks(0);
+    int max_tasks = std::max(1, (int)std::thread::hardware_concurrency()) - 1;
+
+    auto center_coord = [&](int trig_idx, int axis) -> float {
+        return axis == 0 ? centers[trig_idx].x : (axis == 1 ? centers[trig_idx].y : centers[trig_idx].z);
+    };
+
+    std::function<void(int, int, int, int)> build_node = [&](int node_idx, int begin, int end, int depth) {
+        Node &curr_node = tmp_nodes[node_idx];
+        int curr_num_primitives = end - begin;
+
+        // this node should be a leaf node
+        if (curr_num_primitives <= 1 || depth >= BVH_MAX_DEPTH) {
+            curr_node.num_trigs = curr_num_primitives;
+            curr_node.first_trig_idx = begin;
+            return;
+        }
+
+        // bins are spread over the bounding box of the centers, small nodes use fewer bins
+        int num_bins = std::min(NUM_BINS, curr_num_primitives);
+        float center_min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float center_max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (int i = begin; i < end; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                center_min[axis] = std::min(center_min[axis], center_coord(references[i], axis));
+                center_max[axis] = std::max(center_max[axis], center_coord(references[i], axis));
+            }
+        }
+        float bin_scale[3];
+        for (int axis = 0; axis < 3; axis++) {
+            float extent = center_max[axis] - center_min[axis];
+            bin_scale[axis] = extent > 0.f ? num_bins / extent : 0.f;
+        }
+        auto bin_idx = [&](int trig_idx, int axis) -> int {
+            int bin = int((center_coord(trig_idx, axis) - center_min[axis]) * bin_scale[axis]);
+            return std::min(bin, num_bins - 1);
+        };
+
+        // fill bins
+        BoundingBox bin_bboxes[3][NUM_BINS];
+        int bin_counts[3][NUM_BINS] = { };
+        for (int axis = 0; axis < 3; axis++)
+            for (int bin = 0; bin < num_bins; bin++) bin_bboxes[axis][bin].reset();
+        for (int i = begin; i < end; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                int bin = bin_idx(references[i], axis);
+                bin_bboxes[axis][bin].extend(bboxes[references[i]]);
+                bin_counts[axis][bin]++;
+            }
+        }
+
+        float best_cost = FLT_MAX;
+        int best_axis = -1;
+        int best_split_bin = -1;
+
+        // find best split axis and split bin
+        for (int axis = 0; axis < 3; axis++) {
+            if (bin_scale[axis] == 0.f) continue;
+
+            float right_costs[NUM_BINS];
+            BoundingBox tmp_bbox = BoundingBox::Empty();
+            int tmp_count = 0;
+            for (int bin = num_bins - 1; bin > 0; bin--) {
+                tmp_bbox.extend(bin_bboxes[axis][bin]);
+                tmp_count += bin_counts[axis][bin];
+                right_costs[bin] = tmp_count > 0 ? tmp_bbox.half_area() * tmp_count : 0.f;
+            }
+
+            tmp_bbox.reset();
+            tmp_count = 0;
+            for (int bin = 0; bin < num_bins - 1; bin++) {
+                tmp_bbox.extend(bin_bboxes[axis][bin]);
+                tmp_count += bin_counts[axis][bin];
+                if (tmp_count == 0 || tmp_count == curr_num_primitives) continue;
+                float cost = tmp_bbox.half_area() * tmp_count + right_costs[bin + 1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split_bin = bin + 1;
+                }
+            }
+        }
+
+        // if no split is possible or best_cost >= max_split_cost, this node should be a leaf node
+        float max_split_cost = curr_node.bbox.half_area() * (curr_num_primitives - 1);
+        if (best_axis == -1 || best_cost >= max_split_cost) {
+            curr_node.num_trigs = curr_num_primitives;
+            curr_node.first_trig_idx = begin;
+            return;
+        }
+
+        int split_index = std::partition(references + begin, references + end,
+                                         [&](int i) { return bin_idx(i, best_axis) < best_split_bin; }) - references;
+
+        // set bbox of left and right nodes
+        int left_node_index = num_tmp_nodes.fetch_add(2);
+        int right_node_index = left_node_index + 1;
+        Node &left_node = tmp_nodes[left_node_index];
+        Node &right_node = tmp_nodes[right_node_index];
+        left_node.bbox.reset();
+        right_node.bbox.reset();
+        for (int bin = 0; bin < best_split_bin; bin++) left_node.bbox.extend(bin_bboxes[best_axis][bin]);
+        for (int bin = best_split_bin; bin < num_bins; bin++) right_node.bbox.extend(bin_bboxes[best_axis][bin]);
+
+        // now we are sure that this node is an internal node
+        curr_node.num_trigs = 0;
+        curr_node.left_node_idx = left_node_index;
+        int curr_max_depth = max_depth;
+        while (curr_max_depth < depth + 1 && !max_depth.compare_exchange_weak(curr_max_depth, depth + 1)) { }
+
+        // hand the left subtree to another thread if both subtrees are large enough and a thread is available
+        bool spawn_task = false;
+        if (std::min(split_index - begin, end - split_index) >= PARALLEL_MIN_TRIGS) {
+            if (num_tasks.fetch_add(1) < max_tasks) spawn_task = true;
+            else num_tasks--;
+        }
+        if (spawn_task) {
+            auto left_task = std::async(std::launch::async, build_node, left_node_index, begin, split_index, depth + 1);
+            build_node(right_node_index, split_index, end, depth + 1);
+            left_task.get();
+            num_tasks--;
+        } else {
+            build_node(left_node_index, begin, split_index, depth + 1);
+            build_node(right_node_index, split_index, end, depth + 1);
+        }
+    };
+
+    build_node(0, 0, num_triangles, 0);
+
+    // renumber nodes in depth-first order so that the layout does not depend on thread timing
+    num_nodes = num_tmp_nodes;
+    auto ordered_nodes = std::make_unique<Node[]>(num_nodes);
+    ordered_nodes[0] = tmp_nodes[0];
+    int num_ordered_nodes = 1;
+    std::stack<std::array<int, 2>> stack;  // ordered_node_idx, tmp_node_idx
+    stack.push( { 0, 0 } );
+    while (!stack.empty()) {
+        int ordered_node_idx = stack.top()[0];
+        int tmp_node_idx = stack.top()[1];
+        stack.pop();
+        if (tmp_nodes[tmp_node_idx].is_leaf()) continue;
+
+        int tmp_left_node_idx = tmp_nodes[tmp_node_idx].left_node_idx;
+        int left_node_index = num_ordered_nodes;
+        num_ordered_nodes += 2;
+        ordered_nodes[left_node_index] = tmp_nodes[tmp_left_node_idx];
+        ordered_nodes[left_node_index + 1] = tmp_nodes[tmp_left_node_idx + 1];
+        ordered_nodes[ordered_node_idx].left_node_idx = left_node_index;
+        stack.push( { left_node_index + 1, tmp_left_node_idx + 1 } );
+        stack.push( { left_node_index, tmp_left_node_idx } );
+    }
+    std::copy(ordered_nodes.get(), ordered_nodes.get() + num_nodes, tmp_nodes);
+
+    return max_depth;
 }
 
 #endif //RTCORE_SYSTEMC_BVH_HPP
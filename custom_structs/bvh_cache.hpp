@@ -0,0 +1,140 @@
+#ifndef RTCORE_SYSTEMC_BVH_CACHE_HPP
+#define RTCORE_SYSTEMC_BVH_CACHE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bvh.hpp"
+
+// binary BVH cache: a header followed by Bvh::nodes and Bvh::triangles, loaded with mmap and used in place
+struct BvhCache {
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t node_size;
+        uint32_t triangle_size;
+        int32_t num_nodes;
+        int32_t num_triangles;
+        uint64_t key;
+        uint64_t nodes_offset;
+        uint64_t triangles_offset;
+    };
+
+    static constexpr char MAGIC[8] = "RTCBVH";
+    static const uint32_t VERSION = 1;
+    static const uint64_t ALIGNMENT = 64;
+
+    static uint64_t key(const std::string &mesh_path, Bvh::BuildMethod build_method);
+    static std::string path(uint64_t key);
+    static bool load(const std::string &path, uint64_t key, Bvh &bvh);
+    static bool save(const std::string &path, uint64_t key, const Bvh &bvh);
+
+private:
+    static uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ull);
+    static uint64_t align(uint64_t offset) { return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+};
+
+// 64-bit FNV-1a, continuing from hash
+uint64_t BvhCache::fnv1a(const void *data, size_t size, uint64_t hash) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// hash of the raw mesh file and of every setting that changes the built BVH, so the mesh is never parsed on a hit
+uint64_t BvhCache::key(const std::string &mesh_path, Bvh::BuildMethod build_method) {
+    std::ifstream mesh_file(mesh_path, std::ios::binary);
+    std::string mesh_bytes((std::istreambuf_iterator<char>(mesh_file)), std::istreambuf_iterator<char>());
+    uint64_t mesh_hash = fnv1a(mesh_bytes.data(), mesh_bytes.size());
+
+    int settings[] = { (int)build_method, Bvh::BVH_MAX_DEPTH, Bvh::NUM_BINS };
+    return fnv1a(settings, sizeof(settings), mesh_hash);
+}
+
+std::string BvhCache::path(uint64_t key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "bvh_%016llx.bin", (unsigned long long)key);
+    return name;
+}
+
+bool BvhCache::load(const std::string &path, uint64_t key, Bvh &bvh) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+
+    // private writable mapping, so pages are shared with the page cache until someone writes to them
+    size_t size = file_stat.st_size;
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    std::shared_ptr<void> storage(data, [size](void *data) { munmap(data, size); });
+
+    const Header *header = static_cast<const Header *>(data);
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION || header->key != key ||
+        header->node_size != sizeof(Bvh::Node) || header->triangle_size != sizeof(Triangle) ||
+        header->nodes_offset + (uint64_t)header->num_nodes * sizeof(Bvh::Node) > size ||
+        header->triangles_offset + (uint64_t)header->num_triangles * sizeof(Triangle) > size) {
+        std::cout << "Ignoring stale BVH cache " << path << std::endl;
+        return false;
+    }
+
+    bvh.num_nodes = header->num_nodes;
+    bvh.nodes = reinterpret_cast<Bvh::Node *>(static_cast<char *>(data) + header->nodes_offset);
+    bvh.num_triangles = header->num_triangles;
+    bvh.triangles = reinterpret_cast<Triangle *>(static_cast<char *>(data) + header->triangles_offset);
+    bvh.triangles_storage = storage;
+    bvh.nodes_storage = storage;
+
+    std::cout << "Loaded BVH with " << bvh.num_nodes << " nodes and " << bvh.num_triangles
+              << " triangles from " << path << std::endl;
+    return true;
+}
+
+// write to a temporary file first, so concurrent runs never map a partially written cache
+bool BvhCache::save(const std::string &path, uint64_t key, const Bvh &bvh) {
+    Header header = { };
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.node_size = sizeof(Bvh::Node);
+    header.triangle_size = sizeof(Triangle);
+    header.num_nodes = bvh.num_nodes;
+    header.num_triangles = bvh.num_triangles;
+    header.key = key;
+    header.nodes_offset = align(sizeof(Header));
+    header.triangles_offset = align(header.nodes_offset + (uint64_t)bvh.num_nodes * sizeof(Bvh::Node));
+
+    std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+    std::ofstream file(tmp_path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.seekp(header.nodes_offset);
+    file.write(reinterpret_cast<const char *>(bvh.nodes), (std::streamsize)bvh.num_nodes * sizeof(Bvh::Node));
+    file.seekp(header.triangles_offset);
+    file.write(reinterpret_cast<const char *>(bvh.triangles), (std::streamsize)bvh.num_triangles * sizeof(Triangle));
+    file.close();
+
+    if (!file || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        std::cout << "Failed to write BVH cache " << path << std::endl;
+        return false;
+    }
+    std::cout << "Saved BVH cache " << path << std::endl;
+    return true;
+}
+
+#endif //RTCORE_SYSTEMC_BVH_CACHE_HPP
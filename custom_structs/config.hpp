@@ -0,0 +1,260 @@
+#ifndef RTCORE_SYSTEMC_CONFIG_HPP
+#define RTCORE_SYSTEMC_CONFIG_HPP
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// scene, camera and workload settings shared by the simulator and the reference generator.
+// Settings are read from a file of "key = value" lines (--config=<path>) and from --key=value arguments,
+// later ones overriding earlier ones.
+struct Config {
+    // scene
+    std::string ply_path = "../third_party/bun_zipper.ply";
+    int instance_grid = 0;  // n > 1 places n x n instances of the mesh, rotated about y, under a TLAS (two-level BVH)
+
+    // camera, the primary ray of pixel (i, j) goes from origin through
+    // corner + (horizontal * j / width, -vertical * i / height, 0)
+    int width = 600;
+    int height = 600;
+    float origin_x = 0.f;
+    float origin_y = 0.1f;
+    float origin_z = 1.f;
+    float corner_x = -0.1f;
+    float corner_y = 0.2f;
+    float corner_z = 0.f;
+    float horizontal = 0.2f;
+    float vertical = 0.2f;
+
+    // workload
+    bool any_hit = false;  // occlusion rays, which stop at the first hit instead of finding the closest one
+
+    // secondary rays spawned at primary hits, fed back to RTCORE (modules/secondary_rays.hpp)
+    bool shadow_rays = false;  // one shadow ray towards the point light
+    float light_x = 0.5f;
+    float light_y = 1.f;
+    float light_z = 1.f;
+    int ao_samples = 0;  // hemisphere AO rays
+    float ao_radius = 0.02f;
+    int diffuse_bounces = 0;  // length of the diffuse path
+
+    // simulation
+    std::string build_method = "sweep";  // SAH builder of the BVH: sweep or binned (parallel binned SAH)
+    int bvh_width = 2;  // children per BVH node, 4 and 8 collapse the binary BVH
+    bool quantized_nodes = false;  // fetch child boxes quantized to 8 bits per bound
+    std::string sched_policy = "fifo";  // order of the rays RD sends to TRV: fifo, node or treelet
+    int sched_window = 8;  // rays the scheduler chooses from
+    int treelet_nodes = 64;
+    int short_stack_size = 0;  // stack entries per ray, backtracking through parent pointers on overflow, 0 keeps the full stack
+    bool loosely_timed = false;  // use RTCORE_LT instead of the cycle-level RTCORE
+    int num_rtcores = 1;  // more than 1 makes a CLUSTER of RT cores sharing the L2 and DRAM (modules/cluster.hpp)
+    std::string cluster_dispatch = "round_robin";  // which core gets a ray: round_robin or tile
+    int tile_size = 8;  // tiles of tile_size x tile_size pixels, with the tile policy
+    int l2_size = 0;  // bytes of the shared L2, 0 sends L1 misses straight to DRAM
+    long long max_cycles = 200000000;  // the simulation stops earlier, once every ray was retired
+    long long watchdog_cycles = 0;  // reports a deadlock and stops when no ray is issued or retired for this long, 0 never
+    int workers = 1;  // processes simulating interleaved bands of rows in parallel, forked after elaboration
+    int worker = 0;  // band offset of this process, set when it is forked
+
+    // output, image.ppm and intersection.bin are always written (modules/frame_output.hpp)
+    bool text_intersections = false;  // also write intersection.txt, in the format of gen-references
+    bool reuse_distance = false;  // record the reuse distance of child group fetches (modules/memory/reuse_distance.hpp)
+
+    // signal tracing (modules/tracer.hpp), off while trace is empty
+    std::string trace;  // comma-separated glob patterns of signal names, e.g. rtcore.trv_*
+    std::string trace_file = "trace.bin";
+    long long trace_start = 0;  // first traced cycle
+    long long trace_stop = -1;  // cycle after the last traced one, -1 traces to the end
+    std::string trace_trigger;  // pattern=value, only cycles where a matching signal has the value are traced
+
+    // verification against the reference traverser
+    bool verify = false;
+    float verify_tolerance = 1e-4f;  // absolute for u and v, relative for t
+    int verify_max_mismatches = 10;  // the simulation stops after this many mismatches, 0 never stops it
+
+    bool parse(int argc, char *argv[]);
+    bool load(const std::string &path);
+    bool set(const std::string &key, const std::string &value);
+
+    void ray_dir(int pixel_idx, float &dir_x, float &dir_y, float &dir_z) const;
+    bool spawns_secondary_rays() const { return shadow_rays || ao_samples > 0 || diffuse_bounces > 0; }
+};
+
+bool Config::parse(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--lt") arg = "--loosely_timed=1";
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            std::cerr << "Expected --key=value, got " << arg << std::endl;
+            return false;
+        }
+        std::string key = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (!(key == "config" ? load(value) : set(key, value))) return false;
+    }
+    return true;
+}
+
+bool Config::load(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot open config file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        size_t eq = line.find('=');
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        if (eq == std::string::npos) {
+            std::cerr << "Expected key = value in " << path << ", got " << line << std::endl;
+            return false;
+        }
+        auto trim = [](const std::string &s) {
+            size_t first = s.find_first_not_of(" \t\r");
+            size_t last = s.find_last_not_of(" \t\r");
+            return first == std::string::npos ? std::string() : s.substr(first, last - first + 1);
+        };
+        if (!set(trim(line.substr(0, eq)), trim(line.substr(eq + 1)))) return false;
+    }
+    return true;
+}
+
+bool Config::set(const std::string &key, const std::string &value) {
+    try {
+        if (key == "ply_path") ply_path = value;
+        else if (key == "instance_grid") instance_grid = std::stoi(value);
+        else if (key == "width") width = std::stoi(value);
+        else if (key == "height") height = std::stoi(value);
+        else if (key == "origin_x") origin_x = std::stof(value);
+        else if (key == "origin_y") origin_y = std::stof(value);
+        else if (key == "origin_z") origin_z = std::stof(value);
+        else if (key == "corner_x") corner_x = std::stof(value);
+        else if (key == "corner_y") corner_y = std::stof(value);
+        else if (key == "corner_z") corner_z = std::stof(value);
+        else if (key == "horizontal") horizontal = std::stof(value);
+        else if (key == "vertical") vertical = std::stof(value);
+        else if (key == "any_hit") any_hit = (std::stoi(value) != 0);
+        else if (key == "shadow_rays") shadow_rays = (std::stoi(value) != 0);
+        else if (key == "light_x") light_x = std::stof(value);
+        else if (key == "light_y") light_y = std::stof(value);
+        else if (key == "light_z") light_z = std::stof(value);
+        else if (key == "ao_samples") ao_samples = std::stoi(value);
+        else if (key == "ao_radius") ao_radius = std::stof(value);
+        else if (key == "diffuse_bounces") diffuse_bounces = std::stoi(value);
+        else if (key == "build_method") build_method = value;
+        else if (key == "bvh_width") bvh_width = std::stoi(value);
+        else if (key == "sched_policy") sched_policy = value;
+        else if (key == "sched_window") sched_window = std::stoi(value);
+        else if (key == "treelet_nodes") treelet_nodes = std::stoi(value);
+        else if (key == "short_stack_size") short_stack_size = std::stoi(value);
+        else if (key == "quantized_nodes") quantized_nodes = (std::stoi(value) != 0);
+        else if (key == "loosely_timed") loosely_timed = (std::stoi(value) != 0);
+        else if (key == "num_rtcores") num_rtcores = std::stoi(value);
+        else if (key == "cluster_dispatch") cluster_dispatch = value;
+        else if (key == "tile_size") tile_size = std::stoi(value);
+        else if (key == "l2_size") l2_size = std::stoi(value);
+        else if (key == "max_cycles") max_cycles = std::stoll(value);
+        else if (key == "watchdog_cycles") watchdog_cycles = std::stoll(value);
+        else if (key == "workers") workers = std::stoi(value);
+        else if (key == "text_intersections") text_intersections = (std::stoi(value) != 0);
+        else if (key == "reuse_distance") reuse_distance = (std::stoi(value) != 0);
+        else if (key == "trace") trace = value;
+        else if (key == "trace_file") trace_file = value;
+        else if (key == "trace_start") trace_start = std::stoll(value);
+        else if (key == "trace_stop") trace_stop = std::stoll(value);
+        else if (key == "trace_trigger") {
+            size_t eq = value.rfind('=');
+            if (!value.empty() && (eq == std::string::npos || eq == 0)) throw std::invalid_argument(value);
+            if (!value.empty()) std::stod(value.substr(eq + 1));
+            trace_trigger = value;
+        }
+        else if (key == "verify") verify = (std::stoi(value) != 0);
+        else if (key == "verify_tolerance") verify_tolerance = std::stof(value);
+        else if (key == "verify_max_mismatches") verify_max_mismatches = std::stoi(value);
+        else {
+            std::cerr << "Unknown config key " << key << std::endl;
+            return false;
+        }
+    } catch (const std::exception &) {
+        std::cerr << "Invalid value " << value << " for config key " << key << std::endl;
+        return false;
+    }
+
+    if (width <= 0 || height <= 0) {
+        std::cerr << "Resolution must be positive" << std::endl;
+        return false;
+    }
+    if (bvh_width != 2 && bvh_width != 4 && bvh_width != 8) {
+        std::cerr << "bvh_width must be 2, 4 or 8" << std::endl;
+        return false;
+    }
+    if (build_method != "sweep" && build_method != "binned") {
+        std::cerr << "build_method must be sweep or binned" << std::endl;
+        return false;
+    }
+    if (ao_samples < 0 || diffuse_bounces < 0) {
+        std::cerr << "ao_samples and diffuse_bounces must not be negative" << std::endl;
+        return false;
+    }
+    if (sched_policy != "fifo" && sched_policy != "node" && sched_policy != "treelet") {
+        std::cerr << "sched_policy must be fifo, node or treelet" << std::endl;
+        return false;
+    }
+    if (sched_window < 1 || treelet_nodes < 1) {
+        std::cerr << "sched_window and treelet_nodes must be positive" << std::endl;
+        return false;
+    }
+    if (short_stack_size < 0) {
+        std::cerr << "short_stack_size must not be negative" << std::endl;
+        return false;
+    }
+    if (instance_grid < 0 || instance_grid == 1) {
+        std::cerr << "instance_grid must be 0 or at least 2" << std::endl;
+        return false;
+    }
+    if (instance_grid > 0 && short_stack_size > 0) {
+        // parent pointers do not lead from a BLAS back to the instance node it was entered from
+        std::cerr << "short_stack_size cannot be used with instance_grid" << std::endl;
+        return false;
+    }
+    if (num_rtcores < 1 || tile_size < 1 || l2_size < 0) {
+        std::cerr << "num_rtcores and tile_size must be positive, l2_size must not be negative" << std::endl;
+        return false;
+    }
+    if (cluster_dispatch != "round_robin" && cluster_dispatch != "tile") {
+        std::cerr << "cluster_dispatch must be round_robin or tile" << std::endl;
+        return false;
+    }
+    if (watchdog_cycles < 0) {
+        std::cerr << "watchdog_cycles must not be negative" << std::endl;
+        return false;
+    }
+    if (workers < 1) {
+        std::cerr << "workers must be positive" << std::endl;
+        return false;
+    }
+    if (workers > 1 && !trace.empty()) {
+        // every worker would append to the same trace file
+        std::cerr << "trace cannot be used with workers" << std::endl;
+        return false;
+    }
+    if (trace_start < 0 || (trace_stop >= 0 && trace_stop < trace_start)) {
+        std::cerr << "trace_start must not be negative or after trace_stop" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void Config::ray_dir(int pixel_idx, float &dir_x, float &dir_y, float &dir_z) const {
+    float j = pixel_idx % width;
+    float i = pixel_idx / width;
+    dir_x = (corner_x + horizontal * j / width) - origin_x;
+    dir_y = (corner_y - vertical * i / height) - origin_y;
+    dir_z = corner_z - origin_z;
+}
+
+#endif //RTCORE_SYSTEMC_CONFIG_HPP
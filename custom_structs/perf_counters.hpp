@@ -0,0 +1,136 @@
+#ifndef RTCORE_SYSTEMC_PERF_COUNTERS_HPP
+#define RTCORE_SYSTEMC_PERF_COUNTERS_HPP
+
+#include <algorithm>
+#include <functional>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// performance counters of every unit, keyed by the full name of the unit. Units look their counters up once
+// when they are constructed and bump them through the returned references, which stay valid.
+struct PerfCounters {
+    static PerfCounters &get();
+
+    long long &counter(const std::string &unit, const std::string &name);
+    std::vector<long long> &histogram(const std::string &unit, const std::string &name, int num_bins);
+    // a metric derived from other counters, evaluated when the report is written
+    void derived(const std::string &unit, const std::string &name, const std::function<double()> &fn);
+
+    void write_json(std::ostream &os) const;
+
+    // counters and histograms of a worker process (see main.cpp), one per line
+    void write_raw(std::ostream &os) const;
+    // adds what a worker counted since base, the state it was forked from. Counters named max_* keep the maximum
+    bool merge_raw(std::istream &is, const PerfCounters &base);
+
+private:
+    struct Unit {
+        std::map<std::string, long long> counters;
+        std::map<std::string, std::vector<long long>> histograms;
+        std::map<std::string, std::function<double()>> derived;
+    };
+
+    std::map<std::string, Unit> units;
+};
+
+PerfCounters &PerfCounters::get() {
+    static PerfCounters perf_counters;
+    return perf_counters;
+}
+
+long long &PerfCounters::counter(const std::string &unit, const std::string &name) {
+    return units[unit].counters[name];
+}
+
+std::vector<long long> &PerfCounters::histogram(const std::string &unit, const std::string &name, int num_bins) {
+    std::vector<long long> &bins = units[unit].histograms[name];
+    bins.resize(num_bins);
+    return bins;
+}
+
+void PerfCounters::derived(const std::string &unit, const std::string &name, const std::function<double()> &fn) {
+    units[unit].derived[name] = fn;
+}
+
+void PerfCounters::write_json(std::ostream &os) const {
+    os << "{";
+    const char *unit_sep = "\n";
+    for (const auto &[unit_name, unit] : units) {
+        os << unit_sep << "  \"" << unit_name << "\": {";
+        const char *sep = "\n";
+        for (const auto &[name, value] : unit.counters) {
+            os << sep << "    \"" << name << "\": " << value;
+            sep = ",\n";
+        }
+        for (const auto &[name, fn] : unit.derived) {
+            os << sep << "    \"" << name << "\": " << fn();
+            sep = ",\n";
+        }
+        for (const auto &[name, bins] : unit.histograms) {
+            os << sep << "    \"" << name << "\": [";
+            for (int i = 0; i < bins.size(); i++) os << (i == 0 ? "" : ", ") << bins[i];
+            os << "]";
+            sep = ",\n";
+        }
+        os << "\n  }";
+        unit_sep = ",\n";
+    }
+    os << "\n}\n";
+}
+
+void PerfCounters::write_raw(std::ostream &os) const {
+    for (const auto &[unit_name, unit] : units) {
+        for (const auto &[name, value] : unit.counters) os << "c " << unit_name << ' ' << name << ' ' << value << '\n';
+        for (const auto &[name, bins] : unit.histograms) {
+            os << "h " << unit_name << ' ' << name << ' ' << bins.size();
+            for (long long bin : bins) os << ' ' << bin;
+            os << '\n';
+        }
+    }
+    os << "end\n";
+}
+
+bool PerfCounters::merge_raw(std::istream &is, const PerfCounters &base) {
+    auto base_unit = [&](const std::string &unit_name) {
+        static const Unit empty;
+        auto it = base.units.find(unit_name);
+        return it == base.units.end() ? &empty : &it->second;
+    };
+
+    std::string kind, unit_name, name;
+    while (is >> kind && kind != "end") {
+        if (!(is >> unit_name >> name)) return false;
+        const Unit *base_counters = base_unit(unit_name);
+        if (kind == "c") {
+            long long value;
+            if (!(is >> value)) return false;
+            long long &merged = units[unit_name].counters[name];
+            if (name.rfind("max_", 0) == 0) {
+                merged = std::max(merged, value);
+            } else {
+                auto it = base_counters->counters.find(name);
+                merged += value - (it == base_counters->counters.end() ? 0 : it->second);
+            }
+        } else if (kind == "h") {
+            size_t num_bins;
+            if (!(is >> num_bins)) return false;
+            std::vector<long long> &merged = units[unit_name].histograms[name];
+            auto it = base_counters->histograms.find(name);
+            merged.resize(std::max(merged.size(), num_bins));
+            for (size_t i = 0; i < num_bins; i++) {
+                long long value;
+                if (!(is >> value)) return false;
+                bool in_base = (it != base_counters->histograms.end() && i < it->second.size());
+                merged[i] += value - (in_base ? it->second[i] : 0);
+            }
+        } else {
+            return false;
+        }
+    }
+    return kind == "end";
+}
+
+#endif //RTCORE_SYSTEMC_PERF_COUNTERS_HPP
@@ -1,7 +1,33 @@
 #ifndef RTCORE_SYSTEMC_RAY_STATE_HPP
 #define RTCORE_SYSTEMC_RAY_STATE_HPP
 
+#include <algorithm>
+#include <vector>
+#include "bvh.hpp"
+
 struct RayState {
+    // an any-hit ray is done once IST found a hit, its remaining leaves are discarded
+    bool terminated() const { return any_hit && hit; }
+
+    // the next group is an instance node, or an entry of the TLAS was popped while traversing an instance
+    bool crosses_instance() const { return left_node_idx < 0 || (instance_idx >= 0 && stk_size < instance_stk_size); }
+
+    // leaves the instance being traversed, if any, and enters the instance node at left_node_idx, if any: the ray
+    // is moved to the space of the instance and the data for ray-AABB intersection is computed again
+    void cross_instance(const Bvh *bvh);
+
+    // stack entries of a ray: a step pushes up to width - 1 children, and within an instance the entries of the TLAS
+    // stay below those of the BLAS. A short stack keeps at most short_stack_size of them
+    static int stack_entries(int width, bool instanced, int short_stack_size);
+
+    // points the stack of every ray state into storage, stack_entries per ray, as the RT core keeps them
+    static void allocate_stacks(RayState *ray_states, int num_rays, int stack_entries, std::vector<int> &storage);
+
+    // bytes of a ray state and its stack of stack_entries entries, without the pointer to the stack
+    static int bytes(int stack_entries) {
+        return sizeof(RayState) - sizeof(stk_data) - sizeof(stk_capacity) + stack_entries * sizeof(int);
+    }
+
     // ray data
     float origin_x;
     float origin_y;
@@ -10,10 +36,27 @@ struct RayState {
     float dir_y;
     float dir_z;
     float tmax;
+    int tag;  // opaque to RTCORE, returned with the result
+    bool any_hit;  // occlusion ray, terminated by its first hit
 
     // for TRV
     int left_node_idx;
     bool finished;
+    int stk_size;
+    int *stk_data;  // stk_capacity entries, see allocate_stacks()
+    int stk_capacity;
+    bool stk_dropped;  // a full short stack dropped its bottom entry, so the ray backtracks once the stack is empty
+    int backtrack_child;  // when backtracking into the group at left_node_idx, the child the ray returns from, -1 otherwise
+
+    // for instancing, the ray data above is in the space of the instance being traversed
+    int instance_idx;  // -1 in the TLAS
+    int instance_stk_size;  // stack size when the instance was entered, the entries below belong to the TLAS
+    float world_origin_x;
+    float world_origin_y;
+    float world_origin_z;
+    float world_dir_x;
+    float world_dir_y;
+    float world_dir_z;
 
     // for ray-AABB intersection
     float octant_x;
@@ -29,9 +72,61 @@ struct RayState {
     // for IST
     bool hit;
     int hit_trig_idx;
+    int hit_instance_idx;  // -1 without instancing
     float u;
     float v;
 };
 
+int RayState::stack_entries(int width, bool instanced, int short_stack_size) {
+    int full_stack_size = (width - 1) * (Bvh::BVH_MAX_DEPTH - 1) * (instanced ? 2 : 1);
+    return short_stack_size > 0 ? std::min(short_stack_size, full_stack_size) : full_stack_size;
+}
+
+void RayState::allocate_stacks(RayState *ray_states, int num_rays, int stack_entries, std::vector<int> &storage) {
+    storage.assign((size_t)num_rays * stack_entries, 0);
+    for (int i = 0; i < num_rays; i++) {
+        ray_states[i].stk_data = storage.data() + (size_t)i * stack_entries;
+        ray_states[i].stk_capacity = stack_entries;
+    }
+}
+
+void RayState::cross_instance(const Bvh *bvh) {
+    if (instance_idx < 0) {
+        world_origin_x = origin_x;
+        world_origin_y = origin_y;
+        world_origin_z = origin_z;
+        world_dir_x = dir_x;
+        world_dir_y = dir_y;
+        world_dir_z = dir_z;
+    }
+    Vec3 origin(world_origin_x, world_origin_y, world_origin_z);
+    Vec3 dir(world_dir_x, world_dir_y, world_dir_z);
+    instance_idx = -1;
+    if (left_node_idx < 0) {
+        instance_idx = -1 - left_node_idx;
+        const Bvh::Instance &inst = bvh->instances[instance_idx];
+        origin = Bvh::Instance::apply(inst.to_object, origin, 1.f);
+        dir = Bvh::Instance::apply(inst.to_object, dir, 0.f);
+        instance_stk_size = stk_size;
+        left_node_idx = inst.left_node_idx;
+    }
+
+    origin_x = origin.x;
+    origin_y = origin.y;
+    origin_z = origin.z;
+    dir_x = dir.x;
+    dir_y = dir.y;
+    dir_z = dir.z;
+    octant_x = dir.x < 0;
+    octant_y = dir.y < 0;
+    octant_z = dir.z < 0;
+    inv_dir_x = 1.f / ((fabsf(dir.x) < FLT_EPSILON) ? copysignf(FLT_EPSILON, dir.x) : dir.x);
+    inv_dir_y = 1.f / ((fabsf(dir.y) < FLT_EPSILON) ? copysignf(FLT_EPSILON, dir.y) : dir.y);
+    inv_dir_z = 1.f / ((fabsf(dir.z) < FLT_EPSILON) ? copysignf(FLT_EPSILON, dir.z) : dir.z);
+    scaled_origin_x = -origin.x * inv_dir_x;
+    scaled_origin_y = -origin.y * inv_dir_y;
+    scaled_origin_z = -origin.z * inv_dir_z;
+}
+
 
 #endif //RTCORE_SYSTEMC_RAY_STATE_HPP
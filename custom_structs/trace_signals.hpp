@@ -0,0 +1,89 @@
+#ifndef RTCORE_SYSTEMC_TRACE_SIGNALS_HPP
+#define RTCORE_SYSTEMC_TRACE_SIGNALS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// signals that can be traced, named by the full name of the unit and the signal (e.g. tb.rtcore.trv_0.state).
+// Units register their ports and states once when they are constructed. Registering only keeps a reference to the
+// port or signal, and nothing is read unless TRACER is created or the watchdog of TESTBENCH dumps the state of every
+// unit, so the simulation does not slow down without tracing.
+struct TraceSignals {
+    // value types, stored as 32-bit words
+    static constexpr uint8_t BOOL = 0;
+    static constexpr uint8_t INT = 1;
+    static constexpr uint8_t FLOAT = 2;
+
+    struct Signal {
+        std::string name;
+        uint8_t type;
+        std::function<uint32_t()> read;
+
+        double value() const { return decode(read()); }
+        double decode(uint32_t bits) const;
+    };
+
+    static TraceSignals &get();
+
+    // port or signal is anything with read() returning bool, int or float
+    template<typename S>
+    void add(const std::string &unit, const std::string &name, const S &port_or_signal);
+
+    // a bool, int or float field of a port or signal carrying a struct, e.g. the tag of a Ray
+    template<typename S, typename P, typename T>
+    void add(const std::string &unit, const std::string &name, const S &port_or_signal, T P::*field);
+
+    std::vector<Signal> signals;
+
+private:
+    template<typename R>
+    void add_read(const std::string &name, R read);
+};
+
+TraceSignals &TraceSignals::get() {
+    static TraceSignals trace_signals;
+    return trace_signals;
+}
+
+double TraceSignals::Signal::decode(uint32_t bits) const {
+    if (type == FLOAT) {
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    return type == INT ? (double)(int32_t)bits : (double)bits;
+}
+
+template<typename S>
+void TraceSignals::add(const std::string &unit, const std::string &name, const S &port_or_signal) {
+    const S *p = &port_or_signal;
+    add_read(unit + "." + name, [p]() { return p->read(); });
+}
+
+template<typename S, typename P, typename T>
+void TraceSignals::add(const std::string &unit, const std::string &name, const S &port_or_signal, T P::*field) {
+    const S *p = &port_or_signal;
+    add_read(unit + "." + name, [p, field]() { return p->read().*field; });
+}
+
+template<typename R>
+void TraceSignals::add_read(const std::string &name, R read) {
+    using T = std::decay_t<decltype(read())>;
+    static_assert(std::is_same_v<T, bool> || std::is_same_v<T, int> || std::is_same_v<T, float>);
+    if constexpr (std::is_same_v<T, float>) {
+        signals.push_back({ name, FLOAT, [read]() {
+            float value = read();
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            return bits;
+        } });
+    } else {
+        signals.push_back({ name, std::is_same_v<T, bool> ? BOOL : INT, [read]() { return (uint32_t)read(); } });
+    }
+}
+
+#endif //RTCORE_SYSTEMC_TRACE_SIGNALS_HPP
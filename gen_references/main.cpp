@@ -3,22 +3,18 @@
 #include "bvh/sweep_sah_builder.hpp"
 #include "bvh/single_ray_traverser.hpp"
 #include "bvh/primitive_intersectors.hpp"
+#include "../custom_structs/config.hpp"
 
 using Vector3  = bvh::Vector3<float>;
 using Triangle = bvh::Triangle<float>;
 using Ray = bvh::Ray<float>;
 using Bvh = bvh::Bvh<float>;
 
-constexpr int width = 600;
-constexpr int height = 600;
-constexpr float origin_x = 0.f;
-constexpr float origin_y = 0.1f;
-constexpr float origin_z = 1.f;
-constexpr float horizontal = 0.2f;
-constexpr float vertical = 0.2f;
+int main(int argc, char *argv[]) {
+    Config config;
+    if (!config.parse(argc, argv)) return 1;
 
-int main() {
-    happly::PLYData ply_data("../third_party/bun_zipper.ply");
+    happly::PLYData ply_data(config.ply_path);
     std::vector<std::array<double, 3>> v_pos = ply_data.getVertexPositions();
     std::vector<std::vector<size_t>> f_idx = ply_data.getFaceIndices<size_t>();
 
@@ -42,15 +38,14 @@ int main() {
 
     std::ofstream image_file("image_reference.ppm");
     std::ofstream intersection_file("intersection_reference.txt");
-    image_file << "P3\n" << width << ' ' << height << "\n255\n";
+    image_file << "P3\n" << config.width << ' ' << config.height << "\n255\n";
 
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            float dir_x = (-0.1f + horizontal * j / width) - origin_x;
-            float dir_y = (0.2f - vertical * i / height) - origin_y;
-            float dir_z = -1.f;
+    for (int i = 0; i < config.height; i++) {
+        for (int j = 0; j < config.width; j++) {
+            float dir_x, dir_y, dir_z;
+            config.ray_dir(i * config.width + j, dir_x, dir_y, dir_z);
             Ray ray(
-                Vector3(origin_x, origin_y, origin_z),
+                Vector3(config.origin_x, config.origin_y, config.origin_z),
                 Vector3(dir_x, dir_y, dir_z),
                 0.f
             );
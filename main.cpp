@@ -1,13 +1,25 @@
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <systemc>
 using namespace sc_core;
 using namespace sc_dt;
 
 #include "third_party/happly.h"
 #include "custom_structs/bvh.hpp"
+#include "custom_structs/bvh_cache.hpp"
+#include "custom_structs/perf_counters.hpp"
+#include "custom_structs/config.hpp"
 #include "modules/testbench.hpp"
 
-Bvh get_bvh() {
-    happly::PLYData ply_data("../third_party/bun_zipper.ply");
+Bvh get_bvh(const std::string &ply_path, Bvh::BuildMethod build_method) {
+    // skip parsing and building when a cache for this mesh and these builder settings exists
+    uint64_t cache_key = BvhCache::key(ply_path, build_method);
+    std::string cache_path = BvhCache::path(cache_key);
+    Bvh bvh;
+    if (BvhCache::load(cache_path, cache_key, bvh)) return bvh;
+
+    happly::PLYData ply_data(ply_path);
     std::vector<std::array<double, 3>> v_pos = ply_data.getVertexPositions();
     std::vector<std::vector<size_t>> f_idx = ply_data.getFaceIndices<size_t>();
 
@@ -19,12 +31,152 @@ Bvh get_bvh() {
                                Vec3(v_pos[face[2]][0], v_pos[face[2]][1], v_pos[face[2]][2]));
     }
 
-    return Bvh(triangles);
+    bvh = Bvh(triangles, build_method);
+    BvhCache::save(cache_path, cache_key, bvh);
+    return bvh;
+}
+
+// n x n instances of the mesh on a grid in the xz plane, each rotated about y by an angle hashed from its position
+Bvh get_instanced_bvh(const Bvh &blas, int n) {
+    const float *bounds = blas.nodes[0].bbox.bounds;
+    Vec3 center((bounds[0] + bounds[1]) / 2.f, 0.f, (bounds[4] + bounds[5]) / 2.f);
+    float spacing = 1.5f * std::max(bounds[1] - bounds[0], bounds[5] - bounds[4]);
+
+    std::vector<Bvh::Instance> instances;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            uint32_t hash = uint32_t(i * n + j + 1) * 0x9e3779b9u;
+            hash ^= hash >> 16;
+            float angle = (hash & 0xffff) * (2.f * float(M_PI) / 65536.f);
+            float c = cosf(angle);
+            float s = sinf(angle);
+            Vec3 position((j - (n - 1) / 2.f) * spacing, 0.f, (i - (n - 1) / 2.f) * spacing);
+
+            // translate the center of the mesh to the origin, rotate, then move it to its cell
+            float transform[12] = {
+                c, 0.f, s, position.x - (c * center.x + s * center.z),
+                0.f, 1.f, 0.f, 0.f,
+                -s, 0.f, c, position.z - (-s * center.x + c * center.z)
+            };
+            instances.emplace_back(transform, 0);
+        }
+    }
+    return Bvh::instance({ &blas }, instances);
 }
 
-int sc_main(int, char*[]) {
-    Bvh bvh = get_bvh();
-    TESTBENCH tb("tb", &bvh);
-    sc_start(100000000, SC_PS);
-    return 0;
-}
\ No newline at end of file
+// runs the elaborated model in one forked process per worker, each sending the rays of its bands of rows (RAYGEN).
+// Workers shade into the shared mappings of the frame files, and send their counters and secondary-ray results back
+// through a pipe, to be merged as if one process had run. Cycle counters add up the cycles of every worker.
+// A worker stopped by the watchdog exits with status 2 after sending its results, and marks tb as deadlocked.
+bool run_workers(Config &config, TESTBENCH &tb, SecondaryRays *secondary_rays) {
+    PerfCounters base = PerfCounters::get();
+    std::vector<pid_t> pids;
+    std::vector<int> fds;
+    for (int i = 0; i < config.workers; i++) {
+        int fd[2];
+        if (pipe(fd) != 0) {
+            std::cerr << "Cannot create a pipe for worker " << i << std::endl;
+            return false;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fd[0]);
+            config.worker = i;
+            sc_start(sc_time(2, SC_PS) * config.max_cycles);
+            tb.report_unfinished();
+
+            std::ostringstream os;
+            PerfCounters::get().write_raw(os);
+            if (secondary_rays) secondary_rays->write_results(os);
+            std::string results = os.str();
+            for (size_t written = 0; written < results.size();) {
+                ssize_t n = write(fd[1], results.data() + written, results.size() - written);
+                if (n <= 0) _exit(1);
+                written += n;
+            }
+            std::cout.flush();
+            _exit(tb.deadlocked ? 2 : 0);  // the parent writes the outputs
+        }
+        close(fd[1]);
+        if (pid < 0) {
+            std::cerr << "Cannot fork worker " << i << std::endl;
+            close(fd[0]);
+            return false;
+        }
+        pids.push_back(pid);
+        fds.push_back(fd[0]);
+    }
+
+    bool ok = true;
+    for (int i = 0; i < pids.size(); i++) {
+        std::string results;
+        char buf[65536];
+        for (ssize_t n; (n = read(fds[i], buf, sizeof(buf))) > 0;) results.append(buf, n);
+        close(fds[i]);
+        int status;
+        waitpid(pids[i], &status, 0);
+
+        std::istringstream is(results);
+        bool exited = WIFEXITED(status) && (WEXITSTATUS(status) == 0 || WEXITSTATUS(status) == 2);
+        if (exited && WEXITSTATUS(status) == 2) tb.deadlocked = true;
+        if (!exited || !PerfCounters::get().merge_raw(is, base)
+            || (secondary_rays && !secondary_rays->merge_results(is))) {
+            std::cerr << "Worker " << i << " failed" << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int sc_main(int argc, char *argv[]) {
+    Config config;
+    if (!config.parse(argc, argv)) return 1;
+#ifndef RTCORE_VERIFIER
+    if (config.verify) {
+        std::cerr << "verify needs a build with the bvh library (RTCORE_VERIFIER)" << std::endl;
+        return 1;
+    }
+#endif
+
+    Bvh::BuildMethod build_method = (config.build_method == "binned" ? Bvh::BuildMethod::BINNED
+                                                                     : Bvh::BuildMethod::SWEEP);
+    Bvh bvh = get_bvh(config.ply_path, build_method);
+    if (config.bvh_width > 2) bvh = bvh.collapse(config.bvh_width);
+    if (config.instance_grid > 0) bvh = get_instanced_bvh(bvh, config.instance_grid);
+    if (config.quantized_nodes) bvh.quantize();
+    if (config.short_stack_size > 0) bvh.link_parents();
+    MemoryConfig mem_config;
+    mem_config.l2_size = config.l2_size;
+    mem_config.reuse_distance = config.reuse_distance;
+    SharedMemory shared_mem(mem_config);
+    std::vector<std::unique_ptr<Memory>> mems;
+    std::vector<Memory *> mem_ptrs;
+    for (int i = 0; i < config.num_rtcores; i++) {
+        std::string mem_name = (config.num_rtcores == 1 ? "memory" : "memory.rtcore_" + std::to_string(i));
+        mems.push_back(std::make_unique<Memory>(mem_config, &bvh, sc_time(2, SC_PS), &shared_mem, mem_name));
+        mem_ptrs.push_back(mems.back().get());
+    }
+    std::unique_ptr<Verifier> verifier;
+#ifdef RTCORE_VERIFIER
+    if (config.verify) verifier = std::make_unique<Verifier>(&config, &bvh);
+#endif
+    std::unique_ptr<SecondaryRays> secondary_rays;
+    if (config.spawns_secondary_rays()) secondary_rays = std::make_unique<SecondaryRays>(&config, &bvh);
+    TESTBENCH tb("tb", &config, &bvh, mem_ptrs, verifier.get(), secondary_rays.get());
+    if (config.workers == 1) {
+        sc_start(sc_time(2, SC_PS) * config.max_cycles);
+        tb.report_unfinished();
+    } else if (!run_workers(config, tb, secondary_rays.get())) {
+        return 1;
+    }
+
+    // counters of every unit, for scripts comparing configurations
+    std::ofstream perf_file("perf.json");
+    PerfCounters::get().write_json(perf_file);
+
+    if (verifier) {
+        std::cout << "Verified " << verifier->rays << " rays, " << verifier->mismatches << " mismatches" << std::endl;
+        if (verifier->mismatches > 0) return 1;
+    }
+    return tb.deadlocked ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+#ifndef RTCORE_SYSTEMC_CLUSTER_HPP
+#define RTCORE_SYSTEMC_CLUSTER_HPP
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include "../custom_structs/config.hpp"
+#include "../custom_structs/perf_counters.hpp"
+#include "../custom_structs/trace_signals.hpp"
+#include "rtcore/rtcore_base.hpp"
+#include "secondary_rays.hpp"
+
+// cluster of RT cores behind the ports of a single one, each core with its own L1 caches in front of the shared L2 and
+// DRAM (SharedMemory). Rays go to the next core after the last one that can take a ray (round robin), or to the core
+// owning their tile of tile_size x tile_size pixels, tiles being dealt out to the cores in row-major order; spawned
+// rays follow their pixel. The results of each core are buffered in a queue of RESULT_DEPTH entries and merged
+// round-robin, one per cycle, with ray ids made unique as core * ray_ids_per_core + ray id. The m_ready of a core only
+// depends on its queue, since RTCORE raises m_valid only while m_ready is high.
+struct CLUSTER : public RTCORE_BASE {
+    static constexpr int RESULT_DEPTH = 2;
+
+    // dispatch policies
+    static constexpr int ROUND_ROBIN = 0;
+    static constexpr int TILE = 1;
+
+    // submodules
+    std::vector<RTCORE_BASE *> cores;
+
+    // high-level objects
+    const Config *config;
+    const SecondaryRays *secondary_rays;  // nullptr when no rays are spawned
+    int num_cores;
+    int policy;
+    int ray_ids_per_core;
+    std::vector<std::deque<RayResult>> results;
+
+    // internal states
+    sc_signal<int> target;  // core taking the ray on s, -1 when it cannot be taken
+    sc_signal<int> last_target;
+    int last_grant;
+
+    // CLUSTER-cores
+    sc_vector<sc_signal<bool>> core_s_valid;
+    sc_vector<sc_signal<bool>> core_s_ready;
+    sc_vector<sc_signal<bool>> core_m_valid;
+    sc_vector<sc_signal<bool>> core_m_ready;
+    sc_vector<sc_signal<RayResult>> core_m_result;
+
+    // performance counters
+    long long *cycles;
+    long long *rays;
+    long long *dispatch_stalled_cycles;  // a ray waits because its core, or every core, has no free ray id
+    std::vector<long long *> core_rays;
+
+    SC_HAS_PROCESS(CLUSTER);
+    CLUSTER(const sc_module_name &mn, const Config *config, const SecondaryRays *secondary_rays, int ray_ids_per_core,
+            const std::function<RTCORE_BASE *(const char *name, int core)> &new_core);
+
+    void main();
+
+    // the core a ray of tag goes to under the TILE policy
+    int tile_owner(int tag) const;
+
+    void update_target();
+    void update_s_ready();
+    void update_core_s_valid();
+
+    int accepted_ray_id() const override;
+
+    ~CLUSTER();
+};
+
+CLUSTER::CLUSTER(const sc_module_name &mn, const Config *config, const SecondaryRays *secondary_rays,
+                 int ray_ids_per_core, const std::function<RTCORE_BASE *(const char *name, int core)> &new_core)
+    : RTCORE_BASE(mn), config(config), secondary_rays(secondary_rays), num_cores(config->num_rtcores),
+      policy(config->cluster_dispatch == "tile" ? TILE : ROUND_ROBIN), ray_ids_per_core(ray_ids_per_core),
+      results(num_cores), last_grant(num_cores - 1) {
+    core_s_valid.init(num_cores);
+    core_s_ready.init(num_cores);
+    core_m_valid.init(num_cores);
+    core_m_ready.init(num_cores);
+    core_m_result.init(num_cores);
+
+    PerfCounters &perf = PerfCounters::get();
+    for (int i = 0; i < num_cores; i++) {
+        RTCORE_BASE *core = new_core(("rtcore_" + std::to_string(i)).c_str(), i);
+        cores.push_back(core);
+
+        // the ray is broadcast, only the handshake is per core
+        core->s_valid(core_s_valid[i]);
+        core->s_ready(core_s_ready[i]);
+        core->s_ray(s_ray);
+        core->clk(clk);
+        core->srstn(srstn);
+        core->m_valid(core_m_valid[i]);
+        core->m_ready(core_m_ready[i]);
+        core->m_result(core_m_result[i]);
+
+        core_rays.push_back(&perf.counter(name(), "rtcore_" + std::to_string(i) + ".rays"));
+    }
+
+    cycles = &perf.counter(name(), "cycles");
+    rays = &perf.counter(name(), "rays");
+    dispatch_stalled_cycles = &perf.counter(name(), "dispatch_stalled_cycles");
+    perf.derived(name(), "rays_per_cycle", [this]() { return double(*rays) / std::max(1LL, *cycles); });
+
+    TraceSignals &trace = TraceSignals::get();
+    trace.add(name(), "target", target);
+    trace.add(name(), "s_valid", s_valid);
+    trace.add(name(), "s_ready", s_ready);
+    trace.add(name(), "s_tag", s_ray, &Ray::tag);
+    trace.add(name(), "m_valid", m_valid);
+    trace.add(name(), "m_ray_id", m_result, &RayResult::ray_id);
+
+    SC_METHOD(main)
+    sensitive << clk.pos();
+    dont_initialize();
+
+    SC_METHOD(update_target)
+    sensitive << srstn << s_valid << s_ray << last_target;
+    for (int i = 0; i < num_cores; i++) sensitive << core_s_ready[i];
+
+    SC_METHOD(update_s_ready)
+    sensitive << target;
+
+    SC_METHOD(update_core_s_valid)
+    sensitive << s_valid << target;
+}
+
+void CLUSTER::main() {
+    if (!srstn) {
+        last_target = num_cores - 1;
+        last_grant = num_cores - 1;
+        m_valid = false;
+        for (int i = 0; i < num_cores; i++) core_m_ready[i] = false;
+    } else {
+        (*cycles)++;
+        if (s_valid && !s_ready) (*dispatch_stalled_cycles)++;
+        if (s_valid && s_ready) last_target = target;
+
+        bool m_valid_tmp = m_valid;
+        if (m_valid && m_ready) {
+            (*rays)++;
+            m_valid_tmp = false;
+        }
+
+        for (int i = 0; i < num_cores; i++) {
+            if (core_m_valid[i] && core_m_ready[i]) {
+                RayResult result = core_m_result[i];
+                result.ray_id += i * ray_ids_per_core;
+                results[i].push_back(result);
+                (*core_rays[i])++;
+            }
+        }
+
+        // the core after the last granted one has the highest priority
+        for (int j = 1; j <= num_cores && !m_valid_tmp; j++) {
+            int i = (last_grant + j) % num_cores;
+            if (results[i].empty()) continue;
+            m_result = results[i].front();
+            results[i].pop_front();
+            last_grant = i;
+            m_valid_tmp = true;
+        }
+        m_valid = m_valid_tmp;
+
+        for (int i = 0; i < num_cores; i++) core_m_ready[i] = (results[i].size() < RESULT_DEPTH);
+    }
+}
+
+int CLUSTER::tile_owner(int tag) const {
+    int pixel_idx = (secondary_rays && secondary_rays->is_spawned(tag) ? secondary_rays->ray(tag).pixel_idx : tag);
+    int tiles_x = (config->width + config->tile_size - 1) / config->tile_size;
+    int tile = pixel_idx / config->width / config->tile_size * tiles_x + pixel_idx % config->width / config->tile_size;
+    return tile % num_cores;
+}
+
+void CLUSTER::update_target() {
+    int target_tmp = -1;
+    if (srstn && s_valid) {
+        if (policy == TILE) {
+            int owner = tile_owner(s_ray.read().tag);
+            if (core_s_ready[owner]) target_tmp = owner;
+        } else {
+            for (int j = 1; j <= num_cores; j++) {
+                int i = (last_target + j) % num_cores;
+                if (core_s_ready[i]) {
+                    target_tmp = i;
+                    break;
+                }
+            }
+        }
+    }
+    target = target_tmp;
+}
+
+void CLUSTER::update_s_ready() {
+    s_ready = (target != -1);
+}
+
+void CLUSTER::update_core_s_valid() {
+    for (int i = 0; i < num_cores; i++) core_s_valid[i] = (s_valid && target == i);
+}
+
+int CLUSTER::accepted_ray_id() const {
+    int core = target;
+    return core == -1 ? -1 : core * ray_ids_per_core + cores[core]->accepted_ray_id();
+}
+
+CLUSTER::~CLUSTER() {
+    for (RTCORE_BASE *core : cores) delete core;
+}
+
+#endif //RTCORE_SYSTEMC_CLUSTER_HPP
@@ -0,0 +1,122 @@
+#ifndef RTCORE_SYSTEMC_FRAME_OUTPUT_HPP
+#define RTCORE_SYSTEMC_FRAME_OUTPUT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../custom_structs/config.hpp"
+
+// per-pixel results of SHADER, written into memory-mapped files as rays retire: image.ppm as a binary P6 image and
+// intersection.bin as float32 t, u, v per pixel (-1 for a miss, 0 until the pixel retires). Once every pixel of a band
+// of TILE_ROWS rows has retired, its pages are written back and released, so a killed run keeps the finished bands and
+// a large frame does not stay resident.
+struct FrameOutput {
+    static const int TILE_ROWS = 16;
+
+    FrameOutput(const Config *config);
+    ~FrameOutput();
+
+    void write(int pixel_idx, uint8_t r, uint8_t g, uint8_t b, float t, float u, float v);
+
+    // a shared mapping of a file of size bytes, nullptr when it cannot be created
+    struct MappedFile {
+        bool open(const std::string &path, size_t size);
+        void release(size_t begin, size_t end);  // writes back and drops the pages of [begin, end)
+        void close();
+
+        char *data = nullptr;
+        size_t size = 0;
+    };
+
+    const Config *config;
+    int num_pixels;
+    size_t image_offset;  // size of the P6 header
+    MappedFile image;
+    MappedFile intersections;
+    std::vector<int> retired;  // pixels retired per band
+};
+
+bool FrameOutput::MappedFile::open(const std::string &path, size_t size) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+        if (fd >= 0) ::close(fd);
+        std::cerr << "Cannot create output file " << path << std::endl;
+        return false;
+    }
+    void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Cannot map output file " << path << std::endl;
+        return false;
+    }
+    data = static_cast<char *>(mapped);
+    this->size = size;
+    return true;
+}
+
+void FrameOutput::MappedFile::release(size_t begin, size_t end) {
+    if (!data) return;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    begin = begin / page_size * page_size;
+    end = std::min(size, (end + page_size - 1) / page_size * page_size);
+    msync(data + begin, end - begin, MS_ASYNC);
+    madvise(data + begin, end - begin, MADV_DONTNEED);
+}
+
+void FrameOutput::MappedFile::close() {
+    if (data) munmap(data, size);
+    data = nullptr;
+}
+
+FrameOutput::FrameOutput(const Config *config)
+    : config(config), num_pixels(config->width * config->height),
+      retired((config->height + TILE_ROWS - 1) / TILE_ROWS) {
+    char header[64];
+    image_offset = std::snprintf(header, sizeof(header), "P6\n%d %d\n255\n", config->width, config->height);
+    if (image.open("image.ppm", image_offset + 3 * (size_t)num_pixels)) std::memcpy(image.data, header, image_offset);
+    intersections.open("intersection.bin", 3 * sizeof(float) * (size_t)num_pixels);
+}
+
+FrameOutput::~FrameOutput() {
+    // same text as gen-references, to compare with intersection_reference.txt
+    if (config->text_intersections && intersections.data) {
+        const float *tuv = reinterpret_cast<const float *>(intersections.data);
+        std::ofstream intersection_file("intersection.txt");
+        for (int i = 0; i < num_pixels; i++)
+            intersection_file << tuv[3 * i] << ' ' << tuv[3 * i + 1] << ' ' << tuv[3 * i + 2] << '\n';
+    }
+    image.close();
+    intersections.close();
+}
+
+void FrameOutput::write(int pixel_idx, uint8_t r, uint8_t g, uint8_t b, float t, float u, float v) {
+    if (image.data) {
+        uint8_t *rgb = reinterpret_cast<uint8_t *>(image.data + image_offset) + 3 * (size_t)pixel_idx;
+        rgb[0] = r;
+        rgb[1] = g;
+        rgb[2] = b;
+    }
+    if (intersections.data) {
+        float *tuv = reinterpret_cast<float *>(intersections.data) + 3 * (size_t)pixel_idx;
+        tuv[0] = t;
+        tuv[1] = u;
+        tuv[2] = v;
+    }
+
+    int band = pixel_idx / config->width / TILE_ROWS;
+    int band_pixels = std::min(TILE_ROWS, config->height - band * TILE_ROWS) * config->width;
+    if (++retired[band] == band_pixels) {
+        size_t first_pixel = (size_t)band * TILE_ROWS * config->width;
+        image.release(image_offset + 3 * first_pixel, image_offset + 3 * (first_pixel + band_pixels));
+        intersections.release(3 * sizeof(float) * first_pixel, 3 * sizeof(float) * (first_pixel + band_pixels));
+    }
+}
+
+#endif //RTCORE_SYSTEMC_FRAME_OUTPUT_HPP
@@ -0,0 +1,74 @@
+#ifndef RTCORE_SYSTEMC_CACHE_HPP
+#define RTCORE_SYSTEMC_CACHE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../../custom_structs/perf_counters.hpp"
+
+// set-associative cache with LRU replacement, only tags are modeled (data is always read from the BVH arrays)
+struct Cache {
+    Cache(const std::string &name, int size, int line_size, int ways, int hit_latency);
+
+    // returns true on hit, ready is the cycle from which the line can be used (a line still being filled counts as a hit)
+    bool access(uint64_t line_addr, long long cycle, long long &ready);
+    // allocates line_addr over the LRU way of its set, the line can be used from cycle ready on
+    void fill(uint64_t line_addr, long long cycle, long long ready);
+
+    std::string name;
+    int line_size;
+    int ways;
+    int num_sets;
+    int hit_latency;
+
+    // per way, indexed by set * ways + way
+    std::vector<uint64_t> tags;
+    std::vector<bool> valid;
+    std::vector<long long> last_use_cycle;
+    std::vector<long long> ready_cycle;
+
+    // performance counters
+    long long &accesses;
+    long long &hits;
+};
+
+Cache::Cache(const std::string &name, int size, int line_size, int ways, int hit_latency)
+    : name(name), line_size(line_size), ways(ways), num_sets(std::max(1, size / (line_size * ways))),
+      hit_latency(hit_latency), tags(num_sets * ways), valid(num_sets * ways, false),
+      last_use_cycle(num_sets * ways, 0), ready_cycle(num_sets * ways, 0),
+      accesses(PerfCounters::get().counter(name, "accesses")), hits(PerfCounters::get().counter(name, "hits")) {
+    PerfCounters::get().derived(name, "hit_rate", [this]() { return double(hits) / std::max(1LL, accesses); });
+}
+
+bool Cache::access(uint64_t line_addr, long long cycle, long long &ready) {
+    int set = line_addr % num_sets;
+    accesses++;
+    for (int i = set * ways; i < (set + 1) * ways; i++) {
+        if (valid[i] && tags[i] == line_addr) {
+            hits++;
+            last_use_cycle[i] = cycle;
+            ready = std::max(cycle + hit_latency, ready_cycle[i]);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Cache::fill(uint64_t line_addr, long long cycle, long long ready) {
+    int set = line_addr % num_sets;
+    int victim = set * ways;
+    for (int i = set * ways; i < (set + 1) * ways; i++) {
+        if (!valid[i]) {
+            victim = i;
+            break;
+        }
+        if (last_use_cycle[i] < last_use_cycle[victim]) victim = i;
+    }
+    tags[victim] = line_addr;
+    valid[victim] = true;
+    last_use_cycle[victim] = cycle;
+    ready_cycle[victim] = ready;
+}
+
+#endif //RTCORE_SYSTEMC_CACHE_HPP
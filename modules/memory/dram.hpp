@@ -0,0 +1,46 @@
+#ifndef RTCORE_SYSTEMC_DRAM_HPP
+#define RTCORE_SYSTEMC_DRAM_HPP
+
+#include <algorithm>
+#include <string>
+#include "../../custom_structs/perf_counters.hpp"
+
+// DRAM backend with a fixed access latency and a single channel of limited bandwidth
+struct Dram {
+    Dram(const std::string &name, int latency, int bytes_per_cycle);
+
+    // returns the cycle at which a request of size bytes issued at cycle has been served
+    long long read(int size, long long cycle);
+
+    int latency;
+    int bytes_per_cycle;
+    long long next_free_cycle = 0;
+
+    // performance counters
+    long long &requests;
+    long long &bytes;
+    long long &busy_cycles;
+    long long &queueing_cycles;
+};
+
+Dram::Dram(const std::string &name, int latency, int bytes_per_cycle)
+    : latency(latency), bytes_per_cycle(bytes_per_cycle),
+      requests(PerfCounters::get().counter(name, "requests")), bytes(PerfCounters::get().counter(name, "bytes")),
+      busy_cycles(PerfCounters::get().counter(name, "busy_cycles")),
+      queueing_cycles(PerfCounters::get().counter(name, "queueing_cycles")) { }
+
+long long Dram::read(int size, long long cycle) {
+    // requests are served in order, each one occupying the channel for size / bytes_per_cycle cycles
+    long long start_cycle = std::max(cycle, next_free_cycle);
+    long long transfer_cycles = (size + bytes_per_cycle - 1) / bytes_per_cycle;
+    next_free_cycle = start_cycle + transfer_cycles;
+
+    requests++;
+    bytes += size;
+    busy_cycles += transfer_cycles;
+    queueing_cycles += start_cycle - cycle;
+
+    return start_cycle + transfer_cycles + latency;
+}
+
+#endif //RTCORE_SYSTEMC_DRAM_HPP
@@ -0,0 +1,141 @@
+#ifndef RTCORE_SYSTEMC_MEMORY_HPP
+#define RTCORE_SYSTEMC_MEMORY_HPP
+
+#include <memory>
+#include <string>
+#include "cache.hpp"
+#include "dram.hpp"
+#include "reuse_distance.hpp"
+
+struct MemoryConfig {
+    int line_size = 64;
+    int node_cache_size = 16 * 1024;
+    int node_cache_ways = 4;
+    int trig_cache_size = 16 * 1024;
+    int trig_cache_ways = 4;
+    int cache_hit_latency = 0;  // extra cycles on top of the load cycle of the fetching unit
+    int l2_size = 0;  // 0 sends L1 misses straight to DRAM
+    int l2_ways = 16;
+    int l2_hit_latency = 20;
+    int dram_latency = 100;
+    int dram_bytes_per_cycle = 16;
+    bool reuse_distance = false;  // track the reuse distance of child group fetches, which costs time and memory
+};
+
+// L2 and DRAM behind the L1 caches of every Memory, shared by the RTCOREs of a cluster. The L2 takes one line request
+// per cycle, so requests of different cores in the same cycle queue up, counted in queueing_cycles of memory.l2.
+struct SharedMemory {
+    SharedMemory(const MemoryConfig &config);
+
+    // returns the cycle from which a line missed in an L1 at cycle can be used
+    long long read_line(uint64_t line_addr, long long cycle);
+
+    int line_size;
+    int l2_hit_latency;
+    std::unique_ptr<Cache> l2;  // nullptr without L2
+    long long l2_next_free_cycle = 0;
+    Dram dram;
+
+    // performance counters
+    long long *l2_queueing_cycles;
+};
+
+// timing model of the memory holding the BVH as seen by one RTCORE: an L1 node cache for TRV and a triangle cache for
+// IST, both backed by the shared L2 and DRAM. Fetching units ask for the number of cycles they have to stall for a
+// read. Counters are reported under <name>.node_cache and <name>.trig_cache, with the reuse distance of the fetched
+// child groups, if enabled, under <name>.node_cache.group_reuse_distance, and memory.l2 and memory.dram for the shared
+// levels.
+struct Memory {
+    Memory(const MemoryConfig &config, const Bvh *bvh, const sc_time &clk_period, SharedMemory *shared,
+           const std::string &name = "memory");
+
+    int read_nodes(int node_idx, int num_nodes);
+    int read_quantized_node(int quantized_node_idx, int width);  // replaces the nodes when the BVH is quantized
+    int read_triangles(int trig_idx, int num_trigs);
+    int read_instance(int instance_idx);  // through the node cache, like the TLAS nodes
+
+    // BVH arrays are placed back to back in the address space
+    uint64_t nodes_addr;
+    uint64_t triangles_addr;
+    uint64_t instances_addr;
+    sc_time clk_period;
+
+    Cache node_cache;
+    Cache trig_cache;
+    SharedMemory *shared;
+    std::unique_ptr<ReuseDistance> group_reuse;  // nullptr unless config.reuse_distance
+
+private:
+    int read(Cache &cache, uint64_t addr, int size);
+};
+
+SharedMemory::SharedMemory(const MemoryConfig &config)
+    : line_size(config.line_size), l2_hit_latency(config.l2_hit_latency),
+      l2(config.l2_size > 0 ? std::make_unique<Cache>("memory.l2", config.l2_size, config.line_size, config.l2_ways,
+                                                      config.l2_hit_latency) : nullptr),
+      dram("memory.dram", config.dram_latency, config.dram_bytes_per_cycle) {
+    if (l2) l2_queueing_cycles = &PerfCounters::get().counter("memory.l2", "queueing_cycles");
+}
+
+long long SharedMemory::read_line(uint64_t line_addr, long long cycle) {
+    if (!l2) return dram.read(line_size, cycle);
+
+    long long start_cycle = std::max(cycle, l2_next_free_cycle);
+    l2_next_free_cycle = start_cycle + 1;
+    *l2_queueing_cycles += start_cycle - cycle;
+    long long ready_cycle;
+    if (!l2->access(line_addr, start_cycle, ready_cycle)) {
+        ready_cycle = dram.read(line_size, start_cycle + l2_hit_latency);
+        l2->fill(line_addr, start_cycle, ready_cycle);
+    }
+    return ready_cycle;
+}
+
+Memory::Memory(const MemoryConfig &config, const Bvh *bvh, const sc_time &clk_period, SharedMemory *shared,
+               const std::string &name)
+    : nodes_addr(0),
+      triangles_addr((bvh->num_nodes * sizeof(Bvh::Node) + config.line_size - 1) / config.line_size * config.line_size),
+      instances_addr(triangles_addr + (bvh->num_triangles * sizeof(Triangle) + config.line_size - 1)
+                                      / config.line_size * config.line_size),
+      clk_period(clk_period),
+      node_cache(name + ".node_cache", config.node_cache_size, config.line_size, config.node_cache_ways, config.cache_hit_latency),
+      trig_cache(name + ".trig_cache", config.trig_cache_size, config.line_size, config.trig_cache_ways, config.cache_hit_latency),
+      shared(shared),
+      group_reuse(config.reuse_distance ? std::make_unique<ReuseDistance>(name + ".node_cache", "group_reuse_distance")
+                                        : nullptr) { }
+
+int Memory::read_nodes(int node_idx, int num_nodes) {
+    if (group_reuse) group_reuse->access(node_idx);
+    return read(node_cache, nodes_addr + node_idx * sizeof(Bvh::Node), num_nodes * sizeof(Bvh::Node));
+}
+
+int Memory::read_quantized_node(int quantized_node_idx, int width) {
+    int size = Bvh::QuantizedNode::bytes(width);
+    if (group_reuse) group_reuse->access(quantized_node_idx);
+    return read(node_cache, nodes_addr + (uint64_t)quantized_node_idx * size, size);
+}
+
+int Memory::read_triangles(int trig_idx, int num_trigs) {
+    return read(trig_cache, triangles_addr + trig_idx * sizeof(Triangle), num_trigs * sizeof(Triangle));
+}
+
+int Memory::read_instance(int instance_idx) {
+    return read(node_cache, instances_addr + instance_idx * sizeof(Bvh::Instance), sizeof(Bvh::Instance));
+}
+
+// returns the number of cycles until every line of [addr, addr + size) is available
+int Memory::read(Cache &cache, uint64_t addr, int size) {
+    long long cycle = sc_time_stamp() / clk_period;
+    long long ready_cycle = cycle;
+    for (uint64_t line_addr = addr / cache.line_size; line_addr <= (addr + size - 1) / cache.line_size; line_addr++) {
+        long long line_ready_cycle;
+        if (!cache.access(line_addr, cycle, line_ready_cycle)) {
+            line_ready_cycle = shared->read_line(line_addr, cycle + cache.hit_latency);
+            cache.fill(line_addr, cycle, line_ready_cycle);
+        }
+        ready_cycle = std::max(ready_cycle, line_ready_cycle);
+    }
+    return ready_cycle - cycle;
+}
+
+#endif //RTCORE_SYSTEMC_MEMORY_HPP
@@ -0,0 +1,101 @@
+#ifndef RTCORE_SYSTEMC_REUSE_DISTANCE_HPP
+#define RTCORE_SYSTEMC_REUSE_DISTANCE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../../custom_structs/perf_counters.hpp"
+
+// LRU stack distance of a stream of accesses: the number of distinct keys accessed since the previous access of the
+// same key, so an access with a distance below the number of lines of a fully associative LRU cache would hit.
+// Counted with a Fenwick tree over access times that marks the latest access of every key. When time reaches the end
+// of the tree, the latest accesses are renumbered 1..n in order, so time stays below twice the number of distinct keys.
+// Distances go to a histogram with bins 0, 1, 2-3, 4-7, ..., first accesses to a separate counter.
+struct ReuseDistance {
+    static constexpr int NUM_BINS = 24;
+
+    ReuseDistance(const std::string &unit, const std::string &name);
+
+    void access(uint64_t key);
+
+    std::unordered_map<uint64_t, int> last_access;
+    std::vector<char> latest;  // 1 at the time of the latest access of a key
+    std::vector<int> tree;  // Fenwick tree over latest, 1-indexed
+    int time;  // of the last access, at most tree.size() - 1
+
+    // performance counters
+    std::vector<long long> *distances;
+    long long *first_accesses;
+
+private:
+    void compact();
+    void add(int i, int delta);
+    int prefix(int i) const;
+};
+
+ReuseDistance::ReuseDistance(const std::string &unit, const std::string &name)
+    : latest(1 << 16), tree(1 << 16), time(0) {
+    PerfCounters &perf = PerfCounters::get();
+    distances = &perf.histogram(unit, name, NUM_BINS);
+    first_accesses = &perf.counter(unit, name + ".first_accesses");
+}
+
+void ReuseDistance::access(uint64_t key) {
+    if (time + 1 == (int)tree.size()) compact();
+    time++;
+
+    auto it = last_access.find(key);
+    if (it == last_access.end()) {
+        (*first_accesses)++;
+        last_access.emplace(key, time);
+    } else {
+        int distance = prefix(time - 1) - prefix(it->second);
+        int bin = 0;
+        while (distance > 0 && bin < NUM_BINS - 1) {
+            distance >>= 1;
+            bin++;
+        }
+        (*distances)[bin]++;
+
+        latest[it->second] = 0;
+        add(it->second, -1);
+        it->second = time;
+    }
+    latest[time] = 1;
+    add(time, 1);
+}
+
+// drops the times of earlier accesses, doubling the tree if more than half of it is still live
+void ReuseDistance::compact() {
+    std::vector<int> renumbered(latest.size());
+    int num_live = 0;
+    for (int t = 1; t <= time; t++) {
+        if (latest[t]) num_live++;
+        renumbered[t] = num_live;
+    }
+    for (auto &entry : last_access) entry.second = renumbered[entry.second];
+    time = num_live;
+
+    if (2 * num_live >= (int)latest.size()) latest.resize(2 * latest.size());
+    std::fill(latest.begin(), latest.end(), 0);
+    std::fill(latest.begin() + 1, latest.begin() + 1 + num_live, 1);
+    tree.assign(latest.begin(), latest.end());
+    for (int i = 1; i < (int)tree.size(); i++) {
+        int parent = i + (i & -i);
+        if (parent < (int)tree.size()) tree[parent] += tree[i];
+    }
+}
+
+void ReuseDistance::add(int i, int delta) {
+    for (; i < (int)tree.size(); i += i & -i) tree[i] += delta;
+}
+
+int ReuseDistance::prefix(int i) const {
+    int sum = 0;
+    for (; i > 0; i -= i & -i) sum += tree[i];
+    return sum;
+}
+
+#endif //RTCORE_SYSTEMC_REUSE_DISTANCE_HPP
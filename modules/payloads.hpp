@@ -0,0 +1,156 @@
+#ifndef RTCORE_SYSTEMC_PAYLOADS_HPP
+#define RTCORE_SYSTEMC_PAYLOADS_HPP
+
+#include <ostream>
+#include <string>
+
+// payloads of the valid/ready interfaces between units. Each one travels on a single signal next to the valid and
+// ready signals, so a transfer is one signal update instead of one per field. sc_signal needs ==, << and sc_trace.
+
+// RAYGEN-RTCORE
+struct Ray {
+    float origin_x;
+    float origin_y;
+    float origin_z;
+    float dir_x;
+    float dir_y;
+    float dir_z;
+    float tmax;
+    int tag;  // pixel index of a primary ray, see SecondaryRays for spawned rays
+    bool any_hit;
+
+    bool operator==(const Ray &rhs) const {
+        return origin_x == rhs.origin_x && origin_y == rhs.origin_y && origin_z == rhs.origin_z && dir_x == rhs.dir_x
+               && dir_y == rhs.dir_y && dir_z == rhs.dir_z && tmax == rhs.tmax && tag == rhs.tag
+               && any_hit == rhs.any_hit;
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const Ray &ray) {
+        return os << "(" << ray.origin_x << ", " << ray.origin_y << ", " << ray.origin_z << ") + t * (" << ray.dir_x
+                  << ", " << ray.dir_y << ", " << ray.dir_z << "), tmax " << ray.tmax << ", tag " << ray.tag
+                  << (ray.any_hit ? ", any hit" : "");
+    }
+
+    friend void sc_trace(sc_trace_file *tf, const Ray &ray, const std::string &name) {
+        sc_trace(tf, ray.origin_x, name + ".origin_x");
+        sc_trace(tf, ray.origin_y, name + ".origin_y");
+        sc_trace(tf, ray.origin_z, name + ".origin_z");
+        sc_trace(tf, ray.dir_x, name + ".dir_x");
+        sc_trace(tf, ray.dir_y, name + ".dir_y");
+        sc_trace(tf, ray.dir_z, name + ".dir_z");
+        sc_trace(tf, ray.tmax, name + ".tmax");
+        sc_trace(tf, ray.tag, name + ".tag");
+        sc_trace(tf, ray.any_hit, name + ".any_hit");
+    }
+};
+
+// RTCORE-SHADER
+struct RayResult {
+    int ray_id;
+    int tag;
+    bool hit;
+    int hit_trig_idx;
+    int hit_instance_idx;  // -1 without instancing
+    float t;
+    float u;
+    float v;
+
+    bool operator==(const RayResult &rhs) const {
+        return ray_id == rhs.ray_id && tag == rhs.tag && hit == rhs.hit && hit_trig_idx == rhs.hit_trig_idx
+               && hit_instance_idx == rhs.hit_instance_idx && t == rhs.t && u == rhs.u && v == rhs.v;
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const RayResult &result) {
+        os << "ray " << result.ray_id << ", tag " << result.tag;
+        if (!result.hit) return os << ", miss";
+        return os << ", hit triangle " << result.hit_trig_idx << " of instance " << result.hit_instance_idx << " at t "
+                  << result.t << " (u " << result.u << ", v " << result.v << ")";
+    }
+
+    friend void sc_trace(sc_trace_file *tf, const RayResult &result, const std::string &name) {
+        sc_trace(tf, result.ray_id, name + ".ray_id");
+        sc_trace(tf, result.tag, name + ".tag");
+        sc_trace(tf, result.hit, name + ".hit");
+        sc_trace(tf, result.hit_trig_idx, name + ".hit_trig_idx");
+        sc_trace(tf, result.hit_instance_idx, name + ".hit_instance_idx");
+        sc_trace(tf, result.t, name + ".t");
+        sc_trace(tf, result.u, name + ".u");
+        sc_trace(tf, result.v, name + ".v");
+    }
+};
+
+// TRV-trv_list_arb-LIST, the hit leaves of a step are sent in pairs
+struct LeafPair {
+    int ray_id;
+    int node_a_idx;
+    bool node_b_valid;
+    int node_b_idx;
+    bool is_last_pair;  // false when TRV sends more leaves of the ray after this pair
+
+    bool operator==(const LeafPair &rhs) const {
+        return ray_id == rhs.ray_id && node_a_idx == rhs.node_a_idx && node_b_valid == rhs.node_b_valid
+               && node_b_idx == rhs.node_b_idx && is_last_pair == rhs.is_last_pair;
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const LeafPair &pair) {
+        os << "ray " << pair.ray_id << ", leaves " << pair.node_a_idx;
+        if (pair.node_b_valid) os << " and " << pair.node_b_idx;
+        return os << (pair.is_last_pair ? ", last" : "");
+    }
+
+    friend void sc_trace(sc_trace_file *tf, const LeafPair &pair, const std::string &name) {
+        sc_trace(tf, pair.ray_id, name + ".ray_id");
+        sc_trace(tf, pair.node_a_idx, name + ".node_a_idx");
+        sc_trace(tf, pair.node_b_valid, name + ".node_b_valid");
+        sc_trace(tf, pair.node_b_idx, name + ".node_b_idx");
+        sc_trace(tf, pair.is_last_pair, name + ".is_last_pair");
+    }
+};
+
+// entries of the leaf FIFO in LIST, the leaves of a LeafPair one by one
+struct Leaf {
+    int ray_id;
+    int node_idx;
+    bool is_last_node;  // the last leaf of the ray in this traversal step
+
+    bool operator==(const Leaf &rhs) const {
+        return ray_id == rhs.ray_id && node_idx == rhs.node_idx && is_last_node == rhs.is_last_node;
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const Leaf &leaf) {
+        return os << "ray " << leaf.ray_id << ", leaf " << leaf.node_idx << (leaf.is_last_node ? ", last" : "");
+    }
+
+    friend void sc_trace(sc_trace_file *tf, const Leaf &leaf, const std::string &name) {
+        sc_trace(tf, leaf.ray_id, name + ".ray_id");
+        sc_trace(tf, leaf.node_idx, name + ".node_idx");
+        sc_trace(tf, leaf.is_last_node, name + ".is_last_node");
+    }
+};
+
+// LIST-IST, num_trigs contiguous triangles from trig_idx
+struct TrigBatch {
+    int ray_id;
+    int trig_idx;
+    int num_trigs;
+    bool is_last_trig;  // the last batch of the ray, which resumes it
+
+    bool operator==(const TrigBatch &rhs) const {
+        return ray_id == rhs.ray_id && trig_idx == rhs.trig_idx && num_trigs == rhs.num_trigs
+               && is_last_trig == rhs.is_last_trig;
+    }
+
+    friend std::ostream &operator<<(std::ostream &os, const TrigBatch &batch) {
+        return os << "ray " << batch.ray_id << ", triangles " << batch.trig_idx << " + " << batch.num_trigs
+                  << (batch.is_last_trig ? ", last" : "");
+    }
+
+    friend void sc_trace(sc_trace_file *tf, const TrigBatch &batch, const std::string &name) {
+        sc_trace(tf, batch.ray_id, name + ".ray_id");
+        sc_trace(tf, batch.trig_idx, name + ".trig_idx");
+        sc_trace(tf, batch.num_trigs, name + ".num_trigs");
+        sc_trace(tf, batch.is_last_trig, name + ".is_last_trig");
+    }
+};
+
+#endif //RTCORE_SYSTEMC_PAYLOADS_HPP
@@ -1,75 +1,106 @@
 #ifndef RTCORE_SYSTEMC_RAYGEN_HPP
 #define RTCORE_SYSTEMC_RAYGEN_HPP
 
-template<int Width, int Height>
-SC_MODULE(RAYGEN) {
-    // parameters
-    static constexpr float origin_x = 0.f;
-    static constexpr float origin_y = 0.1f;
-    static constexpr float origin_z = 1.f;
-    static constexpr float horizontal = 0.2f;
-    static constexpr float vertical = 0.2f;
+#include <algorithm>
+#include "frame_output.hpp"
+#include "payloads.hpp"
 
+SC_MODULE(RAYGEN) {
     // ports
     sc_in<bool> clk;
     sc_in<bool> srstn;
 
     sc_out<bool> m_valid;
     sc_in<bool> m_ready;
-    sc_out<float> m_origin_x;
-    sc_out<float> m_origin_y;
-    sc_out<float> m_origin_z;
-    sc_out<float> m_dir_x;
-    sc_out<float> m_dir_y;
-    sc_out<float> m_dir_z;
-    sc_out<float> m_tmax;
-    sc_in<int> m_ray_id;
+    sc_out<Ray> m_ray;
 
     // internal signals
-    sc_signal<int> pixel_idx;
+    sc_signal<int> pixel_idx;  // num_pixels once every primary ray was sent
+    sc_signal<bool> spawned;  // the head of the spawned queue is sent instead of the ray of pixel_idx
+    sc_signal<int> num_spawned;  // spawned rays sent, so the outputs follow the head of the queue
 
     // high-level objects
-    std::unordered_map<int, int> *ray_id_to_pixel_idx;
+    const Config *config;
+    SecondaryRays *secondary_rays;  // nullptr when no rays are spawned
+    int num_pixels;
+    int band_pixels;  // pixels of a band of FrameOutput::TILE_ROWS rows, dealt out to the workers in turn
 
     SC_HAS_PROCESS(RAYGEN);
-    RAYGEN(const sc_module_name &mn, std::unordered_map<int, int> *ray_id_to_pixel_idx)
-        : sc_module(mn), ray_id_to_pixel_idx(ray_id_to_pixel_idx) {
+    RAYGEN(const sc_module_name &mn, const Config *config, SecondaryRays *secondary_rays)
+        : sc_module(mn), config(config), secondary_rays(secondary_rays), num_pixels(config->width * config->height),
+          band_pixels(FrameOutput::TILE_ROWS * config->width) {
+        TraceSignals &trace = TraceSignals::get();
+        trace.add(name(), "m_valid", m_valid);
+        trace.add(name(), "m_ready", m_ready);
+        trace.add(name(), "m_tag", m_ray, &Ray::tag);
+        trace.add(name(), "m_any_hit", m_ray, &Ray::any_hit);
+
         SC_METHOD(main)
         sensitive << clk.pos();
         dont_initialize();
 
         SC_METHOD(update_m_valid)
-        sensitive << srstn << pixel_idx;
+        sensitive << srstn << pixel_idx << spawned;
 
-        SC_METHOD(update_m_dir)
-        sensitive << pixel_idx << m_origin_x << m_origin_y;
+        SC_METHOD(update_m_ray)
+        sensitive << pixel_idx << spawned << num_spawned;
     }
 
     void main() {
         if (!srstn) {
-            m_origin_x = origin_x;
-            m_origin_y = origin_y;
-            m_origin_z = origin_z;
-            m_tmax = FLT_MAX;
-            pixel_idx = 0;
+            pixel_idx = std::min(config->worker * band_pixels, num_pixels);
+            spawned = false;
+            num_spawned = 0;
         } else {
             if (m_valid && m_ready) {
-                (*ray_id_to_pixel_idx)[m_ray_id] = pixel_idx;
-                pixel_idx = pixel_idx + 1;
+                if (spawned) {
+                    secondary_rays->queue.pop_front();
+                    num_spawned = num_spawned + 1;
+                } else {
+                    pixel_idx = next_pixel(pixel_idx);
+                }
             }
+
+            // spawned rays go first, so the rays in flight stay bounded by the pixels already started
+            spawned = (secondary_rays && !secondary_rays->queue.empty());
         }
     }
 
+    // the next pixel of the bands of this worker
+    int next_pixel(int pixel) const {
+        pixel++;
+        if (pixel % band_pixels == 0) pixel += (config->workers - 1) * band_pixels;
+        return std::min(pixel, num_pixels);
+    }
+
     void update_m_valid() {
-        m_valid = (srstn && pixel_idx < Width * Height);
+        m_valid = (srstn && (spawned || pixel_idx < num_pixels));
     }
 
-    void update_m_dir() {
-        float j = pixel_idx % Width;
-        float i = pixel_idx / Width;
-        m_dir_x = (-0.1f + horizontal * j / Width) - origin_x;
-        m_dir_y = (0.2f - vertical * i / Height) - origin_y;
-        m_dir_z = -1.f;
+    void update_m_ray() {
+        Ray ray;
+        if (spawned) {
+            int tag = secondary_rays->queue.front();
+            const SpawnedRay &spawned_ray = secondary_rays->ray(tag);
+            ray.origin_x = spawned_ray.origin.x;
+            ray.origin_y = spawned_ray.origin.y;
+            ray.origin_z = spawned_ray.origin.z;
+            ray.dir_x = spawned_ray.dir.x;
+            ray.dir_y = spawned_ray.dir.y;
+            ray.dir_z = spawned_ray.dir.z;
+            ray.tmax = spawned_ray.tmax;
+            ray.tag = tag;
+            ray.any_hit = spawned_ray.any_hit;
+        } else {
+            config->ray_dir(pixel_idx, ray.dir_x, ray.dir_y, ray.dir_z);
+            ray.origin_x = config->origin_x;
+            ray.origin_y = config->origin_y;
+            ray.origin_z = config->origin_z;
+            ray.tmax = FLT_MAX;
+            ray.tag = pixel_idx;
+            ray.any_hit = config->any_hit;
+        }
+        m_ray = ray;
     }
 };
 
@@ -0,0 +1,77 @@
+#ifndef RTCORE_SYSTEMC_RR_ARB_HPP
+#define RTCORE_SYSTEMC_RR_ARB_HPP
+
+// round-robin arbiter between NumSrcs valid/ready sources sharing one sink, e.g. the TRV units requesting LIST or POST
+template<typename T, int NumSrcs>
+SC_MODULE(RR_ARB) {
+    // ports
+    sc_in<bool> s_valid[NumSrcs];
+    sc_out<bool> s_ready[NumSrcs];
+    sc_in<T> s_entry[NumSrcs];
+
+    sc_in<bool> clk;
+    sc_in<bool> srstn;
+
+    sc_out<bool> m_valid;
+    sc_in<bool> m_ready;
+    sc_out<T> m_entry;
+
+    // internal signals
+    sc_signal<int> last_grant;
+    sc_signal<int> grant;
+
+    SC_CTOR(RR_ARB) {
+        SC_METHOD(main)
+        sensitive << clk.pos();
+        dont_initialize();
+
+        SC_METHOD(update_grant)
+        sensitive << last_grant;
+        for (int i = 0; i < NumSrcs; i++) sensitive << s_valid[i];
+
+        SC_METHOD(update_s_ready)
+        sensitive << grant << m_ready;
+
+        SC_METHOD(update_m_valid)
+        sensitive << grant;
+
+        SC_METHOD(update_m_entry)
+        sensitive << grant;
+        for (int i = 0; i < NumSrcs; i++) sensitive << s_entry[i];
+    }
+
+    void main() {
+        if (!srstn) {
+            last_grant = NumSrcs - 1;
+        } else {
+            if (m_valid && m_ready) last_grant = grant;
+        }
+    }
+
+    void update_grant() {
+        // the source after the last granted one has the highest priority
+        int grant_tmp = -1;
+        for (int i = 1; i <= NumSrcs; i++) {
+            int idx = (last_grant + i) % NumSrcs;
+            if (s_valid[idx]) {
+                grant_tmp = idx;
+                break;
+            }
+        }
+        grant = grant_tmp;
+    }
+
+    void update_s_ready() {
+        for (int i = 0; i < NumSrcs; i++) s_ready[i] = (grant == i && m_ready);
+    }
+
+    void update_m_valid() {
+        m_valid = (grant != -1);
+    }
+
+    void update_m_entry() {
+        m_entry = s_entry[grant == -1 ? 0 : grant];
+    }
+};
+
+#endif //RTCORE_SYSTEMC_RR_ARB_HPP
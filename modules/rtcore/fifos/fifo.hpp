@@ -0,0 +1,66 @@
+#ifndef RTCORE_SYSTEMC_FIFO_HPP
+#define RTCORE_SYSTEMC_FIFO_HPP
+
+#include <vector>
+
+// valid/ready FIFO of up to MaxDepth entries, kept in a plain ring buffer of MaxDepth + 1 slots. main drives the
+// outputs from the new state at the rising edge, so a push only updates m_entry when it lands at the head and the cost
+// of a cycle does not grow with MaxDepth. The outputs change in the same cycles as when the slots were signals decoded
+// by methods sensitive to every slot.
+template<typename T, int MaxDepth>
+SC_MODULE(FIFO) {
+    // ports
+    sc_in<bool> s_valid;
+    sc_out<bool> s_ready;
+    sc_in<T> s_entry;
+
+    sc_in<bool> clk;
+    sc_in<bool> srstn;
+
+    sc_out<bool> m_valid;
+    sc_in<bool> m_ready;
+    sc_out<T> m_entry;
+
+    // high-level objects
+    std::vector<T> reset_entries;  // held after reset, at most MaxDepth
+
+    // internal states
+    T entries[MaxDepth + 1];
+    int front;
+    int back;
+
+    // performance counters
+    std::vector<long long> *occupancy;  // cycles spent with each number of entries
+
+    SC_CTOR(FIFO) : entries(), front(0), back(0) {
+        occupancy = &PerfCounters::get().histogram(name(), "occupancy", MaxDepth + 1);
+
+        SC_METHOD(main)
+        sensitive << clk.pos();
+        dont_initialize();
+    }
+
+    void main() {
+        if (!srstn) {
+            front = 0;
+            back = reset_entries.size();
+            for (int i = 0; i < back; i++) entries[i] = reset_entries[i];
+        } else {
+            (*occupancy)[(back - front + MaxDepth + 1) % (MaxDepth + 1)]++;
+
+            if (s_valid && s_ready) {
+                entries[back] = s_entry;
+                back = (back + 1) % (MaxDepth + 1);
+            }
+            if (m_valid && m_ready) {
+                front = (front + 1) % (MaxDepth + 1);
+            }
+        }
+
+        s_ready = ((back + 1) % (MaxDepth + 1) != front);
+        m_valid = (front != back);
+        m_entry = entries[front];
+    }
+};
+
+#endif //RTCORE_SYSTEMC_FIFO_HPP
@@ -0,0 +1,145 @@
+#ifndef RTCORE_SYSTEMC_RD_SCHEDULER_HPP
+#define RTCORE_SYSTEMC_RD_SCHEDULER_HPP
+
+#include <algorithm>
+
+struct SchedulerConfig {
+    // policy definitions
+    static constexpr int FIFO = 0;  // oldest ray first
+    static constexpr int NODE = 1;  // rays whose next child group is the same
+    static constexpr int TREELET = 2;  // rays whose next child group is in the same block of treelet_nodes nodes
+
+    int policy = FIFO;
+    int window = 8;  // rays considered, from the oldest one
+    int treelet_nodes = 64;  // nodes are laid out depth first, so a block of nodes holds nearby subtrees
+};
+
+// working FIFO of RD that can reorder rays for node locality. Within the window of the oldest rays, the next ray has
+// the key of the last dispatched ray, or else the most frequent key, ties going to the older ray. The oldest ray is
+// dispatched once it has been passed over window times. With the FIFO policy it is a plain FIFO. The entries are a
+// plain array, and main notifies entries_changed instead of writing every entry as a signal, so the choice of the next
+// ray is still made a delta cycle after the rising edge, once the units have updated the ray states.
+template<int MaxDepth>
+SC_MODULE(RD_SCHEDULER) {
+    // ports
+    sc_in<bool> s_valid;
+    sc_out<bool> s_ready;
+    sc_in<int> s_ray_id;
+
+    sc_in<bool> clk;
+    sc_in<bool> srstn;
+
+    sc_out<bool> m_valid;
+    sc_in<bool> m_ready;
+    sc_out<int> m_ray_id;
+
+    // high-level objects
+    RayState *ray_states;
+    SchedulerConfig config;
+
+    // internal states
+    int ray_id[MaxDepth];  // in arrival order
+    sc_event entries_changed;
+    sc_signal<int> count;
+    sc_signal<int> last_key;  // key of the last dispatched ray
+    sc_signal<int> skips;  // times the oldest ray was passed over
+    sc_signal<int> select;  // entry dispatched next
+
+    // performance counters
+    std::vector<long long> *occupancy;  // cycles spent with each number of entries
+    long long *reordered;  // rays dispatched before an older one
+
+    SC_HAS_PROCESS(RD_SCHEDULER);
+    RD_SCHEDULER(const sc_module_name &mn, RayState *ray_states, const SchedulerConfig &config)
+        : sc_module(mn), ray_states(ray_states), config(config), ray_id() {
+        PerfCounters &perf = PerfCounters::get();
+        occupancy = &perf.histogram(name(), "occupancy", MaxDepth + 1);
+        reordered = &perf.counter(name(), "reordered");
+
+        SC_METHOD(main)
+        sensitive << clk.pos();
+        dont_initialize();
+
+        SC_METHOD(update_s_ready)
+        sensitive << count;
+
+        SC_METHOD(update_m_valid)
+        sensitive << count;
+
+        SC_METHOD(update_select)
+        sensitive << entries_changed << count << last_key << skips;
+
+        SC_METHOD(update_m_ray_id)
+        sensitive << entries_changed << select;
+    }
+
+    void main() {
+        if (!srstn) {
+            count = 0;
+            last_key = -1;
+            skips = 0;
+        } else {
+            (*occupancy)[count]++;
+
+            int count_tmp = count;
+            if (m_valid && m_ready) {
+                last_key = key(ray_id[select]);
+                skips = (select == 0 ? 0 : skips + 1);
+                if (select != 0) (*reordered)++;
+                for (int i = select; i < count_tmp - 1; i++) ray_id[i] = ray_id[i + 1];
+                count_tmp--;
+                entries_changed.notify(SC_ZERO_TIME);
+            }
+            if (s_valid && s_ready) {
+                ray_id[count_tmp++] = s_ray_id;
+                entries_changed.notify(SC_ZERO_TIME);
+            }
+            count = count_tmp;
+        }
+    }
+
+    // the next child group of the ray, or its treelet
+    int key(int ray_id) const {
+        int left_node_idx = ray_states[ray_id].left_node_idx;
+        return (config.policy == SchedulerConfig::TREELET ? left_node_idx / config.treelet_nodes : left_node_idx);
+    }
+
+    void update_s_ready() {
+        s_ready = (count < MaxDepth);
+    }
+
+    void update_m_valid() {
+        m_valid = (count != 0);
+    }
+
+    void update_select() {
+        int num_candidates = std::min((int)count, config.window);
+        if (config.policy == SchedulerConfig::FIFO || num_candidates <= 1 || skips >= config.window) {
+            select = 0;
+            return;
+        }
+
+        int keys[MaxDepth];
+        for (int i = 0; i < num_candidates; i++) keys[i] = key(ray_id[i]);
+        int select_tmp = 0;
+        int best_matches = 0;
+        for (int i = 0; i < num_candidates; i++) {
+            if (keys[i] == last_key) {
+                select_tmp = i;
+                break;
+            }
+            int matches = std::count(keys, keys + num_candidates, keys[i]);
+            if (matches > best_matches) {
+                select_tmp = i;
+                best_matches = matches;
+            }
+        }
+        select = select_tmp;
+    }
+
+    void update_m_ray_id() {
+        m_ray_id = ray_id[select];
+    }
+};
+
+#endif //RTCORE_SYSTEMC_RD_SCHEDULER_HPP
@@ -1,14 +1,18 @@
 #ifndef RTCORE_SYSTEMC_IST_HPP
 #define RTCORE_SYSTEMC_IST_HPP
 
+// accepts a batch of up to NumLanes contiguous triangles of one ray per cycle. A batch retires Latency cycles later,
+// when it is tested against the tmax of its ray at that time. Batches retire in order, so a ray is only resumed
+// after its last batch has updated the ray state.
+template<int Latency, int NumLanes>
 SC_MODULE(IST) {
     // ports
     sc_in<bool> s_valid;
-    sc_in<int> s_ray_id;
-    sc_in<int> s_trig_idx;
-    sc_in<bool> s_is_last_trig;
+    sc_out<bool> s_ready;
+    sc_in<TrigBatch> s_batch;
 
     sc_in<bool> clk;
+    sc_in<bool> srstn;
 
     sc_out<bool> m_valid;
     sc_out<int> m_ray_id;
@@ -16,18 +20,127 @@ SC_MODULE(IST) {
     // high-level objects
     Bvh *bvh;
     RayState *ray_states;
+    Memory *mem;  // nullptr when triangle fetches have no latency
+
+    // internal signals
+    // a batch that missed in memory is held here until it arrives
+    sc_signal<bool> mem_stalled;
+    sc_signal<TrigBatch> stalled_batch;
+
+    // pipeline stages, a batch entering stage 0 retires from stage Latency - 1
+    sc_signal<bool> pipe_valid[Latency];
+    sc_signal<TrigBatch> pipe_batch[Latency];
+
+    // internal states
+    int mem_stall;  // cycles until the stalled batch arrives, not a signal as it changes every cycle
+
+    // performance counters
+    long long *busy_cycles;
+    long long *idle_cycles;  // no triangle to intersect
+    long long *stalled_cycles;  // waiting for triangles
+    long long *batches;
+    long long *trigs;
 
     SC_HAS_PROCESS(IST);
-    IST(const sc_module_name &mn, Bvh *bvh, RayState *ray_states)
-        : sc_module(mn), bvh(bvh), ray_states(ray_states) {
+    IST(const sc_module_name &mn, Bvh *bvh, RayState *ray_states, Memory *mem)
+        : sc_module(mn), bvh(bvh), ray_states(ray_states), mem(mem), mem_stall(0) {
+        static_assert(Latency >= 1 && NumLanes >= 1, "IST needs at least one stage and one lane");
+
+        PerfCounters &perf = PerfCounters::get();
+        busy_cycles = &perf.counter(name(), "busy_cycles");
+        idle_cycles = &perf.counter(name(), "idle_cycles");
+        stalled_cycles = &perf.counter(name(), "stalled_cycles");
+        batches = &perf.counter(name(), "batches");
+        trigs = &perf.counter(name(), "trigs");
+        perf.derived(name(), "lane_utilization", [this]() {
+            return double(*trigs) / std::max(1LL, *batches * NumLanes);
+        });
+
+        TraceSignals &trace = TraceSignals::get();
+        trace.add(name(), "stalled_ray_id", stalled_batch, &TrigBatch::ray_id);
+        trace.add(name(), "s_valid", s_valid);
+        trace.add(name(), "s_ready", s_ready);
+        trace.add(name(), "s_ray_id", s_batch, &TrigBatch::ray_id);
+        trace.add(name(), "s_trig_idx", s_batch, &TrigBatch::trig_idx);
+        trace.add(name(), "s_num_trigs", s_batch, &TrigBatch::num_trigs);
+        trace.add(name(), "s_is_last_trig", s_batch, &TrigBatch::is_last_trig);
+        trace.add(name(), "m_valid", m_valid);
+        trace.add(name(), "m_ray_id", m_ray_id);
+
         SC_METHOD(main)
         sensitive << clk.pos();
         dont_initialize();
+
+        SC_METHOD(update_s_ready)
+        sensitive << mem_stalled;
     }
 
     void main() {
+        if (!srstn) {
+            mem_stall = 0;
+            mem_stalled = false;
+            for (int i = 0; i < Latency; i++) pipe_valid[i] = false;
+            m_valid = false;
+        } else {
+            count_cycle();
+
+            // retire, the last batch of a ray resumes it
+            const TrigBatch &retired = pipe_batch[Latency - 1].read();
+            if (pipe_valid[Latency - 1]) {
+                for (int i = 0; i < retired.num_trigs; i++) intersect(retired.ray_id, retired.trig_idx + i);
+            }
+            m_valid = (pipe_valid[Latency - 1] && retired.is_last_trig);
+            m_ray_id = retired.ray_id;
+
+            // advance
+            for (int i = Latency - 1; i > 0; i--) {
+                pipe_valid[i] = pipe_valid[i - 1];
+                pipe_batch[i] = pipe_batch[i - 1];
+            }
+
+            // issue, a batch enters the pipeline once its triangles have arrived
+            pipe_valid[0] = false;
+            if (mem_stall == 0) {
+                if (s_valid) {
+                    const TrigBatch &batch = s_batch.read();
+                    int latency = (mem && batch.num_trigs > 0 ? mem->read_triangles(batch.trig_idx, batch.num_trigs)
+                                                              : 0);
+                    if (latency > 0) {
+                        mem_stall = latency;
+                        stalled_batch = batch;
+                    } else {
+                        issue(batch);
+                    }
+                }
+            } else if (mem_stall > 1) {
+                mem_stall = mem_stall - 1;
+            } else {
+                mem_stall = 0;
+                issue(stalled_batch);
+            }
+            mem_stalled = (mem_stall != 0);
+        }
+    }
+
+    void issue(const TrigBatch &batch) {
+        pipe_valid[0] = true;
+        pipe_batch[0] = batch;
+        (*batches)++;
+        (*trigs) += batch.num_trigs;
+    }
+
+    void count_cycle() {
+        if (mem_stall != 0) (*stalled_cycles)++;
+        else if (!s_valid) (*idle_cycles)++;
+        else (*busy_cycles)++;
+    }
+
+    void intersect(int ray_id, int trig_idx) {
+        // a hit terminates an any-hit ray, later batches keep its first hit
+        if (ray_states[ray_id].terminated()) return;
+
         // load triangle from memory
-        Triangle* trig = &bvh->triangles[s_trig_idx];
+        Triangle* trig = &bvh->triangles[trig_idx];
         float n_x = trig->n.x;
         float n_y = trig->n.y;
         float n_z = trig->n.z;
@@ -42,13 +155,13 @@ SC_MODULE(IST) {
         float e2_z = trig->e2.z;
 
         // load ray data from memory
-        float origin_x = ray_states[s_ray_id].origin_x;
-        float origin_y = ray_states[s_ray_id].origin_y;
-        float origin_z = ray_states[s_ray_id].origin_z;
-        float dir_x = ray_states[s_ray_id].dir_x;
-        float dir_y = ray_states[s_ray_id].dir_y;
-        float dir_z = ray_states[s_ray_id].dir_z;
-        float tmax = ray_states[s_ray_id].tmax;
+        float origin_x = ray_states[ray_id].origin_x;
+        float origin_y = ray_states[ray_id].origin_y;
+        float origin_z = ray_states[ray_id].origin_z;
+        float dir_x = ray_states[ray_id].dir_x;
+        float dir_y = ray_states[ray_id].dir_y;
+        float dir_z = ray_states[ray_id].dir_z;
+        float tmax = ray_states[ray_id].tmax;
 
         float c_x = p0_x - origin_x;
         float c_y = p0_y - origin_y;
@@ -64,15 +177,17 @@ SC_MODULE(IST) {
         t_tmp = inv_det * (c_x * n_x + c_y * n_y + c_z * n_z);
 
         if (u_tmp >= 0.0f && v_tmp >= 0.0f && (u_tmp + v_tmp) <= 1.0f && 0 < t_tmp && t_tmp <= tmax) {
-           ray_states[s_ray_id].tmax = t_tmp;
-           ray_states[s_ray_id].hit = true;
-           ray_states[s_ray_id].hit_trig_idx = s_trig_idx;
-           ray_states[s_ray_id].u = u_tmp;
-           ray_states[s_ray_id].v = v_tmp;
+           ray_states[ray_id].tmax = t_tmp;
+           ray_states[ray_id].hit = true;
+           ray_states[ray_id].hit_trig_idx = trig_idx;
+           ray_states[ray_id].hit_instance_idx = ray_states[ray_id].instance_idx;
+           ray_states[ray_id].u = u_tmp;
+           ray_states[ray_id].v = v_tmp;
         }
+    }
 
-        m_valid = s_valid && s_is_last_trig;
-        m_ray_id = s_ray_id;
+    void update_s_ready() {
+        s_ready = !mem_stalled;
     }
 };
 
@@ -1,9 +1,12 @@
 #ifndef RTCORE_SYSTEMC_LIST_HPP
 #define RTCORE_SYSTEMC_LIST_HPP
 
-#include "fifos/list_fifo.hpp"
+#include <algorithm>
+#include "fifos/fifo.hpp"
 
-template<int MaxDepth>
+// sends the triangles of each leaf in batches of up to NumLanes contiguous triangles. The leaves of a terminated
+// any-hit ray are discarded, except that its last leaf becomes an empty batch, so IST still resumes the ray.
+template<int MaxDepth, int NumLanes>
 SC_MODULE(LIST) {
     // send_state definitions
     static constexpr int IDLE = 0;
@@ -13,62 +16,84 @@ SC_MODULE(LIST) {
     // ports
     sc_in<bool> s_valid;
     sc_out<bool> s_ready;
-    sc_in<int> s_ray_id;
-    sc_in<int> s_node_a_idx;
-    sc_in<bool> s_node_b_valid;
-    sc_in<int> s_node_b_idx;
+    sc_in<LeafPair> s_pair;
 
     sc_in<bool> clk;
     sc_in<bool> srstn;
 
     sc_out<bool> m_valid;
-    sc_out<int> m_ray_id;
-    sc_out<int> m_trig_idx;
-    sc_out<bool> m_is_last_trig;
+    sc_in<bool> m_ready;
+    sc_out<TrigBatch> m_batch;
 
     // submodules
-    LIST_FIFO<MaxDepth> list_fifo;
+    FIFO<Leaf, MaxDepth> list_fifo;
 
     // high-level objects
     Bvh *bvh;
+    RayState *ray_states;
 
     // internal signals
     sc_signal<bool> lf_s_valid;
     sc_signal<bool> lf_s_ready;
-    sc_signal<int> lf_s_ray_id;
-    sc_signal<int> lf_s_node_idx;
-    sc_signal<bool> lf_s_is_last_node;
+    sc_signal<Leaf> lf_s_leaf;
     sc_signal<bool> lf_m_valid;
     sc_signal<bool> lf_m_ready;
-    sc_signal<int> lf_m_ray_id;
-    sc_signal<int> lf_m_node_idx;
-    sc_signal<bool> lf_m_is_last_node;
+    sc_signal<Leaf> lf_m_leaf;
 
     sc_signal<bool> recv_node_a;
-    sc_signal<int> recv_ray_id;
-    sc_signal<int> recv_node_b_idx;
+    sc_signal<LeafPair> recv_pair;  // holds node b while node a goes to list_fifo
 
     sc_signal<int> send_state;
+    sc_signal<int> send_ray_id;
+    sc_signal<int> send_trig_idx;
     sc_signal<int> send_node_idx;
     sc_signal<bool> send_is_last_node;
     sc_signal<int> send_last_trig_idx;
 
+    // performance counters
+    long long *busy_cycles;
+    long long *idle_cycles;  // no leaf to send
+    long long *stalled_cycles;  // waiting for IST
+    long long *leaves;
+    long long *batches;
+    long long *discarded_leaves;  // of terminated any-hit rays
+
     SC_HAS_PROCESS(LIST);
-    LIST(const sc_module_name &mn, Bvh *bvh)
-        : sc_module(mn), list_fifo("list_fifo"), bvh(bvh) {
-        // link LIST_FIFO
+    LIST(const sc_module_name &mn, Bvh *bvh, RayState *ray_states)
+        : sc_module(mn), list_fifo("list_fifo"), bvh(bvh), ray_states(ray_states) {
+        // link list_fifo
         list_fifo.s_valid(lf_s_valid);
         list_fifo.s_ready(lf_s_ready);
-        list_fifo.s_ray_id(lf_s_ray_id);
-        list_fifo.s_node_idx(lf_s_node_idx);
-        list_fifo.s_is_last_node(lf_s_is_last_node);
+        list_fifo.s_entry(lf_s_leaf);
         list_fifo.clk(clk);
         list_fifo.srstn(srstn);
         list_fifo.m_valid(lf_m_valid);
         list_fifo.m_ready(lf_m_ready);
-        list_fifo.m_ray_id(lf_m_ray_id);
-        list_fifo.m_node_idx(lf_m_node_idx);
-        list_fifo.m_is_last_node(lf_m_is_last_node);
+        list_fifo.m_entry(lf_m_leaf);
+
+        PerfCounters &perf = PerfCounters::get();
+        busy_cycles = &perf.counter(name(), "busy_cycles");
+        idle_cycles = &perf.counter(name(), "idle_cycles");
+        stalled_cycles = &perf.counter(name(), "stalled_cycles");
+        leaves = &perf.counter(name(), "leaves");
+        batches = &perf.counter(name(), "batches");
+        discarded_leaves = &perf.counter(name(), "discarded_leaves");
+
+        TraceSignals &trace = TraceSignals::get();
+        trace.add(name(), "send_state", send_state);
+        trace.add(name(), "s_valid", s_valid);
+        trace.add(name(), "s_ready", s_ready);
+        trace.add(name(), "s_ray_id", s_pair, &LeafPair::ray_id);
+        trace.add(name(), "s_node_a_idx", s_pair, &LeafPair::node_a_idx);
+        trace.add(name(), "s_node_b_valid", s_pair, &LeafPair::node_b_valid);
+        trace.add(name(), "s_node_b_idx", s_pair, &LeafPair::node_b_idx);
+        trace.add(name(), "s_is_last_pair", s_pair, &LeafPair::is_last_pair);
+        trace.add(name(), "m_valid", m_valid);
+        trace.add(name(), "m_ready", m_ready);
+        trace.add(name(), "m_ray_id", m_batch, &TrigBatch::ray_id);
+        trace.add(name(), "m_trig_idx", m_batch, &TrigBatch::trig_idx);
+        trace.add(name(), "m_num_trigs", m_batch, &TrigBatch::num_trigs);
+        trace.add(name(), "m_is_last_trig", m_batch, &TrigBatch::is_last_trig);
 
         SC_METHOD(recv)
         sensitive << clk.pos();
@@ -84,20 +109,14 @@ SC_MODULE(LIST) {
         SC_METHOD(update_m_valid)
         sensitive << send_state;
 
-        SC_METHOD(update_m_is_last_trig)
-        sensitive << send_is_last_node << m_trig_idx << send_last_trig_idx;
+        SC_METHOD(update_m_batch)
+        sensitive << send_ray_id << send_trig_idx << send_last_trig_idx << send_is_last_node;
 
         SC_METHOD(update_lf_s_valid)
         sensitive << recv_node_a << s_valid;
 
-        SC_METHOD(update_lf_s_ray_id)
-        sensitive << recv_node_a << s_ray_id << recv_ray_id;
-
-        SC_METHOD(update_lf_s_node_idx)
-        sensitive << recv_node_a << s_node_a_idx << recv_node_b_idx;
-
-        SC_METHOD(update_lf_s_is_last_node)
-        sensitive << recv_node_a << s_node_b_valid;
+        SC_METHOD(update_lf_s_payload)
+        sensitive << recv_node_a << s_pair << recv_pair;
 
         SC_METHOD(update_lf_m_ready)
         sensitive << send_state;
@@ -109,10 +128,9 @@ SC_MODULE(LIST) {
         } else {
             if (lf_s_valid && lf_s_ready) {
                 if (!recv_node_a) recv_node_a = true;
-                else if (s_node_b_valid) {
+                else if (s_pair.read().node_b_valid) {
                     recv_node_a = false;
-                    recv_ray_id = s_ray_id;
-                    recv_node_b_idx = s_node_b_idx;
+                    recv_pair = s_pair;
                 }
             }
         }
@@ -122,31 +140,53 @@ SC_MODULE(LIST) {
         if (!srstn) {
             send_state = IDLE;
         } else {
+            count_cycle();
+
             if (send_state == IDLE) {
                 if (lf_m_valid && lf_m_ready) {
-                    m_ray_id = lf_m_ray_id;
-                    send_node_idx = lf_m_node_idx;
-                    send_is_last_node = lf_m_is_last_node;
+                    const Leaf &leaf = lf_m_leaf.read();
+                    send_ray_id = leaf.ray_id;
+                    send_node_idx = leaf.node_idx;
+                    send_is_last_node = leaf.is_last_node;
 
                     // update send_state
                     send_state = LOAD;
+                    (*leaves)++;
                 }
             } else if (send_state == LOAD) {
-                int first_trig_idx = bvh->nodes[send_node_idx].first_trig_idx;
-                m_trig_idx = first_trig_idx;
-                send_last_trig_idx = first_trig_idx + bvh->nodes[send_node_idx].num_trigs - 1;
+                if (ray_states[send_ray_id].terminated()) {
+                    (*discarded_leaves)++;
+                    send_trig_idx = 0;
+                    send_last_trig_idx = -1;
 
-                // update send_state
-                send_state = SEND;
+                    // update send_state
+                    send_state = (send_is_last_node ? SEND : IDLE);
+                } else {
+                    int first_trig_idx = bvh->nodes[send_node_idx].first_trig_idx;
+                    send_trig_idx = first_trig_idx;
+                    send_last_trig_idx = first_trig_idx + bvh->nodes[send_node_idx].num_trigs - 1;
+
+                    // update send_state
+                    send_state = SEND;
+                }
             } else if (send_state == SEND) {
-                m_trig_idx = m_trig_idx + 1;
+                if (m_ready) {
+                    send_trig_idx = send_trig_idx + NumLanes;
+                    (*batches)++;
 
-                // update send_state
-                if (m_trig_idx == send_last_trig_idx) send_state = IDLE;
+                    // update send_state
+                    if (send_trig_idx + NumLanes > send_last_trig_idx) send_state = IDLE;
+                }
             }
         }
     }
 
+    void count_cycle() {
+        if (send_state == IDLE && !lf_m_valid) (*idle_cycles)++;
+        else if (send_state == SEND && !m_ready) (*stalled_cycles)++;
+        else (*busy_cycles)++;
+    }
+
     void update_s_ready() {
         s_ready = (recv_node_a && lf_s_ready);
     }
@@ -155,24 +195,19 @@ SC_MODULE(LIST) {
         m_valid = (send_state == SEND);
     }
 
-    void update_m_is_last_trig() {
-        m_is_last_trig = (send_is_last_node && m_trig_idx == send_last_trig_idx);
+    void update_m_batch() {
+        m_batch = TrigBatch { send_ray_id, send_trig_idx, std::min(NumLanes, send_last_trig_idx - send_trig_idx + 1),
+                              send_is_last_node && send_trig_idx + NumLanes > send_last_trig_idx };
     }
 
     void update_lf_s_valid() {
         lf_s_valid = (!recv_node_a || s_valid);
     }
 
-    void update_lf_s_ray_id() {
-        lf_s_ray_id = (recv_node_a ? s_ray_id : recv_ray_id);
-    }
-
-    void update_lf_s_node_idx() {
-        lf_s_node_idx = (recv_node_a ? s_node_a_idx : recv_node_b_idx);
-    }
-
-    void update_lf_s_is_last_node() {
-        lf_s_is_last_node = (!recv_node_a || !s_node_b_valid);
+    void update_lf_s_payload() {
+        const LeafPair &pair = (recv_node_a ? s_pair.read() : recv_pair.read());
+        lf_s_leaf = Leaf { pair.ray_id, recv_node_a ? pair.node_a_idx : pair.node_b_idx,
+                           recv_node_a ? (!pair.node_b_valid && pair.is_last_pair) : pair.is_last_pair };
     }
 
     void update_lf_m_ready() {
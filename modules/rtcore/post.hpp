@@ -13,15 +13,10 @@ SC_MODULE(POST) {
 
     sc_out<bool> m_valid;
     sc_in<bool> m_ready;
-    sc_out<int> m_ray_id;
-    sc_out<bool> m_hit;
-    sc_out<int> m_hit_trig_idx;
-    sc_out<float> m_t;
-    sc_out<float> m_u;
-    sc_out<float> m_v;
+    sc_out<RayResult> m_result;
 
     // submodules
-    RD_POST_FIFO<MaxDepth> post_fifo;
+    FIFO<int, MaxDepth> post_fifo;
 
     // high-level objects
     RayState *ray_states;
@@ -36,17 +31,42 @@ SC_MODULE(POST) {
 
     sc_signal<bool> valid;
 
+    // performance counters
+    long long *busy_cycles;
+    long long *idle_cycles;  // no ray to return
+    long long *stalled_cycles;  // waiting for the consumer of RTCORE
+
     SC_HAS_PROCESS(POST);
     POST(const sc_module_name &mn, RayState *ray_states)
         : sc_module(mn), post_fifo("post_fifo"), ray_states(ray_states) {
         post_fifo.s_valid(pf_s_valid);
         post_fifo.s_ready(pf_s_ready);
-        post_fifo.s_ray_id(pf_s_ray_id);
+        post_fifo.s_entry(pf_s_ray_id);
         post_fifo.clk(clk);
         post_fifo.srstn(srstn);
         post_fifo.m_valid(pf_m_valid);
         post_fifo.m_ready(pf_m_ready);
-        post_fifo.m_ray_id(pf_m_ray_id);
+        post_fifo.m_entry(pf_m_ray_id);
+
+        PerfCounters &perf = PerfCounters::get();
+        busy_cycles = &perf.counter(name(), "busy_cycles");
+        idle_cycles = &perf.counter(name(), "idle_cycles");
+        stalled_cycles = &perf.counter(name(), "stalled_cycles");
+
+        TraceSignals &trace = TraceSignals::get();
+        trace.add(name(), "s_valid", s_valid);
+        trace.add(name(), "s_ready", s_ready);
+        trace.add(name(), "s_ray_id", s_ray_id);
+        trace.add(name(), "m_valid", m_valid);
+        trace.add(name(), "m_ready", m_ready);
+        trace.add(name(), "m_ray_id", m_result, &RayResult::ray_id);
+        trace.add(name(), "m_tag", m_result, &RayResult::tag);
+        trace.add(name(), "m_hit", m_result, &RayResult::hit);
+        trace.add(name(), "m_hit_trig_idx", m_result, &RayResult::hit_trig_idx);
+        trace.add(name(), "m_hit_instance_idx", m_result, &RayResult::hit_instance_idx);
+        trace.add(name(), "m_t", m_result, &RayResult::t);
+        trace.add(name(), "m_u", m_result, &RayResult::u);
+        trace.add(name(), "m_v", m_result, &RayResult::v);
 
         SC_METHOD(main)
         sensitive << clk.pos();
@@ -72,20 +92,25 @@ SC_MODULE(POST) {
         if (!srstn) {
             valid = false;
         } else {
+            count_cycle();
+
             if (pf_m_valid && pf_m_ready) {
                 valid = true;
-                m_ray_id = pf_m_ray_id;
-                m_hit = ray_states[pf_m_ray_id].hit;
-                m_hit_trig_idx = ray_states[pf_m_ray_id].hit_trig_idx;
-                m_t = ray_states[pf_m_ray_id].tmax;
-                m_u = ray_states[pf_m_ray_id].u;
-                m_v = ray_states[pf_m_ray_id].v;
+                const RayState &ray = ray_states[pf_m_ray_id];
+                m_result = RayResult { pf_m_ray_id, ray.tag, ray.hit, ray.hit_trig_idx, ray.hit_instance_idx, ray.tmax,
+                                       ray.u, ray.v };
             } else if (m_valid && m_ready) {
                 valid = false;
             }
         }
     }
 
+    void count_cycle() {
+        if (!valid) (*idle_cycles)++;
+        else if (!m_ready) (*stalled_cycles)++;
+        else (*busy_cycles)++;
+    }
+
     void update_s_ready() {
         s_ready = pf_s_ready;
     }
@@ -1,24 +1,19 @@
 #ifndef RTCORE_SYSTEMC_RD_HPP
 #define RTCORE_SYSTEMC_RD_HPP
 
-#include "fifos/rd_post_fifo.hpp"
+#include "fifos/fifo.hpp"
+#include "fifos/rd_scheduler.hpp"
 
 template<int MaxWorkingRays>
 SC_MODULE(RD) {
     // ports
     sc_in<bool> s_alloc_valid;
     sc_out<bool> s_alloc_ready;
-    sc_in<float> s_origin_x;
-    sc_in<float> s_origin_y;
-    sc_in<float> s_origin_z;
-    sc_in<float> s_dir_x;
-    sc_in<float> s_dir_y;
-    sc_in<float> s_dir_z;
-    sc_in<float> s_tmax;
+    sc_in<Ray> s_ray;
     sc_out<int> s_alloc_ray_id;
 
     sc_in<bool> s_release_valid;
-    sc_in<int> s_release_ray_id;
+    sc_in<RayResult> s_release_result;  // the result leaving RTCORE, whose ray id is freed
 
     sc_in<bool> s_resume_valid;
     sc_in<int> s_resume_ray_id;
@@ -31,8 +26,8 @@ SC_MODULE(RD) {
     sc_out<int> m_ray_id;
 
     // submodules
-    RD_POST_FIFO<MaxWorkingRays, true> free_fifo;
-    RD_POST_FIFO<MaxWorkingRays, false> working_fifo;
+    FIFO<int, MaxWorkingRays> free_fifo;
+    RD_SCHEDULER<MaxWorkingRays> working_fifo;
 
     // high-level objects
     RayState *ray_states;
@@ -52,18 +47,26 @@ SC_MODULE(RD) {
     sc_signal<bool> wf_m_ready;
     sc_signal<int> wf_m_ray_id;
 
+    // performance counters
+    long long *allocs;
+    long long *alloc_stalled_cycles;  // a new ray waits for a free ray id
+    long long *resumes;
+    long long *releases;
+
     SC_HAS_PROCESS(RD);
-    RD(const sc_module_name &mn, RayState *ray_states)
+    RD(const sc_module_name &mn, RayState *ray_states, const SchedulerConfig &sched_config)
         : sc_module(mn), free_fifo("free_fifo"),
-          working_fifo("working_fifo"), ray_states(ray_states) {
+          working_fifo("working_fifo", ray_states, sched_config), ray_states(ray_states) {
+        // every ray id is free after reset
+        for (int i = 0; i < MaxWorkingRays; i++) free_fifo.reset_entries.push_back(i);
         free_fifo.s_valid(ff_s_valid);
         free_fifo.s_ready(ff_s_ready);
-        free_fifo.s_ray_id(ff_s_ray_id);
+        free_fifo.s_entry(ff_s_ray_id);
         free_fifo.clk(clk);
         free_fifo.srstn(srstn);
         free_fifo.m_valid(ff_m_valid);
         free_fifo.m_ready(ff_m_ready);
-        free_fifo.m_ray_id(ff_m_ray_id);
+        free_fifo.m_entry(ff_m_ray_id);
 
         working_fifo.s_valid(wf_s_valid);
         working_fifo.s_ready(wf_s_ready);
@@ -74,6 +77,24 @@ SC_MODULE(RD) {
         working_fifo.m_ready(wf_m_ready);
         working_fifo.m_ray_id(wf_m_ray_id);
 
+        PerfCounters &perf = PerfCounters::get();
+        allocs = &perf.counter(name(), "allocs");
+        alloc_stalled_cycles = &perf.counter(name(), "alloc_stalled_cycles");
+        resumes = &perf.counter(name(), "resumes");
+        releases = &perf.counter(name(), "releases");
+
+        TraceSignals &trace = TraceSignals::get();
+        trace.add(name(), "s_alloc_valid", s_alloc_valid);
+        trace.add(name(), "s_alloc_ready", s_alloc_ready);
+        trace.add(name(), "s_alloc_ray_id", s_alloc_ray_id);
+        trace.add(name(), "s_release_valid", s_release_valid);
+        trace.add(name(), "s_release_ray_id", s_release_result, &RayResult::ray_id);
+        trace.add(name(), "s_resume_valid", s_resume_valid);
+        trace.add(name(), "s_resume_ray_id", s_resume_ray_id);
+        trace.add(name(), "m_valid", m_valid);
+        trace.add(name(), "m_ready", m_ready);
+        trace.add(name(), "m_ray_id", m_ray_id);
+
         SC_METHOD(main)
         sensitive << clk.pos();
         dont_initialize();
@@ -94,7 +115,7 @@ SC_MODULE(RD) {
         sensitive << s_release_valid;
 
         SC_METHOD(update_ff_s_ray_id)
-        sensitive << s_release_ray_id;
+        sensitive << s_release_result;
 
         SC_METHOD(update_ff_m_ready)
         sensitive << s_alloc_valid << s_alloc_ready;
@@ -111,32 +132,50 @@ SC_MODULE(RD) {
 
     void main() {
         if (srstn)  {
+            if (s_alloc_valid && !s_alloc_ready) (*alloc_stalled_cycles)++;
+            if (s_resume_valid) (*resumes)++;
+            if (s_release_valid) (*releases)++;
+
             if (s_alloc_valid && s_alloc_ready) {
-                ray_states[s_alloc_ray_id].origin_x = s_origin_x;
-                ray_states[s_alloc_ray_id].origin_y = s_origin_y;
-                ray_states[s_alloc_ray_id].origin_z = s_origin_z;
-                ray_states[s_alloc_ray_id].dir_x = s_dir_x;
-                ray_states[s_alloc_ray_id].dir_y = s_dir_y;
-                ray_states[s_alloc_ray_id].dir_z = s_dir_z;
-                ray_states[s_alloc_ray_id].tmax = s_tmax;
-
-                ray_states[s_alloc_ray_id].left_node_idx = 1;
-                ray_states[s_alloc_ray_id].finished = false;
-
-                ray_states[s_alloc_ray_id].octant_x = s_dir_x < 0;
-                ray_states[s_alloc_ray_id].octant_y = s_dir_y < 0;
-                ray_states[s_alloc_ray_id].octant_z = s_dir_z < 0;
-                float inv_dir_x_tmp = 1.f / ((fabsf(s_dir_x) < FLT_EPSILON) ? copysignf(FLT_EPSILON, s_dir_x) : s_dir_x);
-                float inv_dir_y_tmp = 1.f / ((fabsf(s_dir_y) < FLT_EPSILON) ? copysignf(FLT_EPSILON, s_dir_y) : s_dir_y);
-                float inv_dir_z_tmp = 1.f / ((fabsf(s_dir_z) < FLT_EPSILON) ? copysignf(FLT_EPSILON, s_dir_z) : s_dir_z);
-                ray_states[s_alloc_ray_id].inv_dir_x = inv_dir_x_tmp;
-                ray_states[s_alloc_ray_id].inv_dir_y = inv_dir_y_tmp;
-                ray_states[s_alloc_ray_id].inv_dir_z = inv_dir_z_tmp;
-                ray_states[s_alloc_ray_id].scaled_origin_x = -s_origin_x * inv_dir_x_tmp;
-                ray_states[s_alloc_ray_id].scaled_origin_y = -s_origin_y * inv_dir_y_tmp;
-                ray_states[s_alloc_ray_id].scaled_origin_z = -s_origin_z * inv_dir_z_tmp;
-
-                ray_states[s_alloc_ray_id].hit = false;
+                (*allocs)++;
+
+                const Ray &ray = s_ray.read();
+                RayState &ray_state = ray_states[s_alloc_ray_id];
+                ray_state.origin_x = ray.origin_x;
+                ray_state.origin_y = ray.origin_y;
+                ray_state.origin_z = ray.origin_z;
+                ray_state.dir_x = ray.dir_x;
+                ray_state.dir_y = ray.dir_y;
+                ray_state.dir_z = ray.dir_z;
+                ray_state.tmax = ray.tmax;
+                ray_state.tag = ray.tag;
+                ray_state.any_hit = ray.any_hit;
+
+                ray_state.left_node_idx = 1;
+                ray_state.finished = false;
+                ray_state.stk_size = 0;
+                ray_state.stk_dropped = false;
+                ray_state.backtrack_child = -1;
+                ray_state.instance_idx = -1;
+
+                ray_state.octant_x = ray.dir_x < 0;
+                ray_state.octant_y = ray.dir_y < 0;
+                ray_state.octant_z = ray.dir_z < 0;
+                float inv_dir_x_tmp =
+                    1.f / ((fabsf(ray.dir_x) < FLT_EPSILON) ? copysignf(FLT_EPSILON, ray.dir_x) : ray.dir_x);
+                float inv_dir_y_tmp =
+                    1.f / ((fabsf(ray.dir_y) < FLT_EPSILON) ? copysignf(FLT_EPSILON, ray.dir_y) : ray.dir_y);
+                float inv_dir_z_tmp =
+                    1.f / ((fabsf(ray.dir_z) < FLT_EPSILON) ? copysignf(FLT_EPSILON, ray.dir_z) : ray.dir_z);
+                ray_state.inv_dir_x = inv_dir_x_tmp;
+                ray_state.inv_dir_y = inv_dir_y_tmp;
+                ray_state.inv_dir_z = inv_dir_z_tmp;
+                ray_state.scaled_origin_x = -ray.origin_x * inv_dir_x_tmp;
+                ray_state.scaled_origin_y = -ray.origin_y * inv_dir_y_tmp;
+                ray_state.scaled_origin_z = -ray.origin_z * inv_dir_z_tmp;
+
+                ray_state.hit = false;
+                ray_state.hit_instance_idx = -1;
             }
         }
     }
@@ -162,7 +201,7 @@ SC_MODULE(RD) {
     }
 
     void update_ff_s_ray_id() {
-        ff_s_ray_id = s_release_ray_id;
+        ff_s_ray_id = s_release_result.read().ray_id;
     }
 
     void update_ff_m_ready() {
@@ -1,136 +1,168 @@
 #ifndef RTCORE_SYSTEMC_RTCORE_HPP
 #define RTCORE_SYSTEMC_RTCORE_HPP
 
+#include <string>
 #include "../../custom_structs/ray_state.hpp"
+#include "../../custom_structs/perf_counters.hpp"
+#include "../../custom_structs/trace_signals.hpp"
+#include "../memory/memory.hpp"
+#include "rtcore_base.hpp"
 #include "rd.hpp"
+#include "trv_dispatch.hpp"
 #include "trv.hpp"
+#include "arbiters/rr_arb.hpp"
 #include "list.hpp"
 #include "post.hpp"
 #include "ist.hpp"
 
-template<int MaxWorkingRays>
-SC_MODULE(RTCORE) {
-    // ports
-    sc_in<bool> s_valid;
-    sc_out<bool> s_ready;
-    sc_in<float> s_origin_x;
-    sc_in<float> s_origin_y;
-    sc_in<float> s_origin_z;
-    sc_in<float> s_dir_x;
-    sc_in<float> s_dir_y;
-    sc_in<float> s_dir_z;
-    sc_in<float> s_tmax;
-    sc_out<int> s_ray_id;
-
-    sc_in<bool> clk;
-    sc_in<bool> srstn;
-
-    sc_out<bool> m_valid;
-    sc_in<bool> m_ready;
-    sc_out<int> m_ray_id;
-    sc_out<bool> m_hit;
-    sc_out<int> m_hit_trig_idx;
-    sc_out<float> m_t;
-    sc_out<float> m_u;
-    sc_out<float> m_v;
-
+template<int MaxWorkingRays, int NumTrvs = 1, int IstLatency = 1, int IstLanes = 1, int BvhWidth = 2>
+struct RTCORE : public RTCORE_BASE {
     // submodules
     RD<MaxWorkingRays> rd;
-    TRV<MaxWorkingRays> trv;
-    LIST<MaxWorkingRays> list;
+    TRV_DISPATCH<NumTrvs> trv_dispatch;
+    TRV<BvhWidth> *trv[NumTrvs];
+    RR_ARB<LeafPair, NumTrvs> trv_list_arb;
+    RR_ARB<int, NumTrvs> trv_post_arb;
+    LIST<MaxWorkingRays, IstLanes> list;
     POST<MaxWorkingRays> post;
-    IST ist;
+    IST<IstLatency, IstLanes> ist;
 
     // high-level objects
     RayState ray_states[MaxWorkingRays];
+    std::vector<int> stacks;  // of the ray states
 
     // internal signals
+    sc_signal<int> alloc_ray_id;
+
     // RD-IST
     sc_signal<bool> rd_ist_valid;
     sc_signal<int> rd_ist_ray_id;
 
-    // RD-TRV
-    sc_signal<bool> rd_trv_valid;
-    sc_signal<bool> rd_trv_ready;
-    sc_signal<int> rd_trv_ray_id;
+    // RD-TRV_DISPATCH
+    sc_signal<bool> rd_dispatch_valid;
+    sc_signal<bool> rd_dispatch_ready;
+    sc_signal<int> rd_dispatch_ray_id;
+
+    // TRV_DISPATCH-TRV
+    sc_signal<bool> dispatch_trv_valid[NumTrvs];
+    sc_signal<bool> dispatch_trv_ready[NumTrvs];
+    sc_signal<int> dispatch_trv_ray_id[NumTrvs];
+
+    // TRV-trv_list_arb
+    sc_signal<bool> trv_list_arb_valid[NumTrvs];
+    sc_signal<bool> trv_list_arb_ready[NumTrvs];
+    sc_signal<LeafPair> trv_list_arb_pair[NumTrvs];
 
-    // TRV-LIST
+    // TRV-trv_post_arb
+    sc_signal<bool> trv_post_arb_valid[NumTrvs];
+    sc_signal<bool> trv_post_arb_ready[NumTrvs];
+    sc_signal<int> trv_post_arb_ray_id[NumTrvs];
+
+    // trv_list_arb-LIST
     sc_signal<bool> trv_list_valid;
     sc_signal<bool> trv_list_ready;
-    sc_signal<int> trv_list_ray_id;
-    sc_signal<int> trv_list_node_a_idx;
-    sc_signal<bool> trv_list_node_b_valid;
-    sc_signal<int> trv_list_node_b_idx;
+    sc_signal<LeafPair> trv_list_pair;
 
-    // TRV-POST
+    // trv_post_arb-POST
     sc_signal<bool> trv_post_valid;
     sc_signal<bool> trv_post_ready;
     sc_signal<int> trv_post_ray_id;
 
     // LIST-IST
     sc_signal<bool> list_ist_valid;
-    sc_signal<int> list_ist_ray_id;
-    sc_signal<int> list_ist_trig_idx;
-    sc_signal<bool> list_ist_is_last_trig;
+    sc_signal<bool> list_ist_ready;
+    sc_signal<TrigBatch> list_ist_batch;
+
+    // performance counters
+    long long *cycles;
+    long long *rays;
 
     // vcd file
     sc_trace_file* tf;
 
     SC_HAS_PROCESS(RTCORE);
-    RTCORE(const sc_module_name &mn, Bvh *bvh)
-        : sc_module(mn), rd("rd", ray_states),
-          trv("trv", bvh, ray_states), list("list", bvh),
-          post("post", ray_states), ist("ist", bvh, ray_states) {
+    RTCORE(const sc_module_name &mn, Bvh *bvh, Memory *mem = nullptr, int short_stack_size = 0,
+           const SchedulerConfig &sched_config = SchedulerConfig())
+        : RTCORE_BASE(mn), rd("rd", ray_states, sched_config), trv_dispatch("trv_dispatch"),
+          trv_list_arb("trv_list_arb"), trv_post_arb("trv_post_arb"), list("list", bvh, ray_states),
+          post("post", ray_states), ist("ist", bvh, ray_states, mem) {
+        for (int i = 0; i < NumTrvs; i++) {
+            trv[i] = new TRV<BvhWidth>(("trv_" + std::to_string(i)).c_str(), bvh, ray_states, mem, short_stack_size);
+        }
+
         // link RD
         rd.s_alloc_valid(s_valid);
         rd.s_alloc_ready(s_ready);
-        rd.s_origin_x(s_origin_x);
-        rd.s_origin_y(s_origin_y);
-        rd.s_origin_z(s_origin_z);
-        rd.s_dir_x(s_dir_x);
-        rd.s_dir_y(s_dir_y);
-        rd.s_dir_z(s_dir_z);
-        rd.s_tmax(s_tmax);
-        rd.s_alloc_ray_id(s_ray_id);
+        rd.s_ray(s_ray);
+        rd.s_alloc_ray_id(alloc_ray_id);
         rd.s_release_valid(m_valid);
-        rd.s_release_ray_id(m_ray_id);
+        rd.s_release_result(m_result);
         rd.s_resume_valid(rd_ist_valid);
         rd.s_resume_ray_id(rd_ist_ray_id);
         rd.clk(clk);
         rd.srstn(srstn);
-        rd.m_valid(rd_trv_valid);
-        rd.m_ready(rd_trv_ready);
-        rd.m_ray_id(rd_trv_ray_id);
+        rd.m_valid(rd_dispatch_valid);
+        rd.m_ready(rd_dispatch_ready);
+        rd.m_ray_id(rd_dispatch_ray_id);
+
+        // link TRV_DISPATCH
+        trv_dispatch.s_valid(rd_dispatch_valid);
+        trv_dispatch.s_ready(rd_dispatch_ready);
+        trv_dispatch.s_ray_id(rd_dispatch_ray_id);
+        for (int i = 0; i < NumTrvs; i++) {
+            trv_dispatch.m_valid[i](dispatch_trv_valid[i]);
+            trv_dispatch.m_ready[i](dispatch_trv_ready[i]);
+            trv_dispatch.m_ray_id[i](dispatch_trv_ray_id[i]);
+        }
 
         // link TRV
-        trv.s_valid(rd_trv_valid);
-        trv.s_ready(rd_trv_ready);
-        trv.s_ray_id(rd_trv_ray_id);
-        trv.clk(clk);
-        trv.srstn(srstn);
-        trv.m_list_valid(trv_list_valid);
-        trv.m_list_ready(trv_list_ready);
-        trv.m_list_ray_id(trv_list_ray_id);
-        trv.m_list_node_a_idx(trv_list_node_a_idx);
-        trv.m_list_node_b_valid(trv_list_node_b_valid);
-        trv.m_list_node_b_idx(trv_list_node_b_idx);
-        trv.m_post_valid(trv_post_valid);
-        trv.m_post_ready(trv_post_ready);
-        trv.m_post_ray_id(trv_post_ray_id);
+        for (int i = 0; i < NumTrvs; i++) {
+            trv[i]->s_valid(dispatch_trv_valid[i]);
+            trv[i]->s_ready(dispatch_trv_ready[i]);
+            trv[i]->s_ray_id(dispatch_trv_ray_id[i]);
+            trv[i]->clk(clk);
+            trv[i]->srstn(srstn);
+            trv[i]->m_list_valid(trv_list_arb_valid[i]);
+            trv[i]->m_list_ready(trv_list_arb_ready[i]);
+            trv[i]->m_list_pair(trv_list_arb_pair[i]);
+            trv[i]->m_post_valid(trv_post_arb_valid[i]);
+            trv[i]->m_post_ready(trv_post_arb_ready[i]);
+            trv[i]->m_post_ray_id(trv_post_arb_ray_id[i]);
+        }
+
+        // link trv_list_arb
+        for (int i = 0; i < NumTrvs; i++) {
+            trv_list_arb.s_valid[i](trv_list_arb_valid[i]);
+            trv_list_arb.s_ready[i](trv_list_arb_ready[i]);
+            trv_list_arb.s_entry[i](trv_list_arb_pair[i]);
+        }
+        trv_list_arb.clk(clk);
+        trv_list_arb.srstn(srstn);
+        trv_list_arb.m_valid(trv_list_valid);
+        trv_list_arb.m_ready(trv_list_ready);
+        trv_list_arb.m_entry(trv_list_pair);
+
+        // link trv_post_arb
+        for (int i = 0; i < NumTrvs; i++) {
+            trv_post_arb.s_valid[i](trv_post_arb_valid[i]);
+            trv_post_arb.s_ready[i](trv_post_arb_ready[i]);
+            trv_post_arb.s_entry[i](trv_post_arb_ray_id[i]);
+        }
+        trv_post_arb.clk(clk);
+        trv_post_arb.srstn(srstn);
+        trv_post_arb.m_valid(trv_post_valid);
+        trv_post_arb.m_ready(trv_post_ready);
+        trv_post_arb.m_entry(trv_post_ray_id);
 
         // link LIST
         list.s_valid(trv_list_valid);
         list.s_ready(trv_list_ready);
-        list.s_ray_id(trv_list_ray_id);
-        list.s_node_a_idx(trv_list_node_a_idx);
-        list.s_node_b_valid(trv_list_node_b_valid);
-        list.s_node_b_idx(trv_list_node_b_idx);
+        list.s_pair(trv_list_pair);
         list.clk(clk);
         list.srstn(srstn);
         list.m_valid(list_ist_valid);
-        list.m_ray_id(list_ist_ray_id);
-        list.m_trig_idx(list_ist_trig_idx);
-        list.m_is_last_trig(list_ist_is_last_trig);
+        list.m_ready(list_ist_ready);
+        list.m_batch(list_ist_batch);
 
         // link POST
         post.s_valid(trv_post_valid);
@@ -140,21 +172,59 @@ SC_MODULE(RTCORE) {
         post.srstn(srstn);
         post.m_valid(m_valid);
         post.m_ready(m_ready);
-        post.m_ray_id(m_ray_id);
-        post.m_hit(m_hit);
-        post.m_hit_trig_idx(m_hit_trig_idx);
-        post.m_t(m_t);
-        post.m_u(m_u);
-        post.m_v(m_v);
+        post.m_result(m_result);
 
         // link IST
         ist.s_valid(list_ist_valid);
-        ist.s_ray_id(list_ist_ray_id);
-        ist.s_trig_idx(list_ist_trig_idx);
-        ist.s_is_last_trig(list_ist_is_last_trig);
+        ist.s_ready(list_ist_ready);
+        ist.s_batch(list_ist_batch);
         ist.clk(clk);
+        ist.srstn(srstn);
         ist.m_valid(rd_ist_valid);
         ist.m_ray_id(rd_ist_ray_id);
+
+        PerfCounters &perf = PerfCounters::get();
+        cycles = &perf.counter(name(), "cycles");
+        rays = &perf.counter(name(), "rays");
+        perf.derived(name(), "rays_per_cycle", [this]() { return double(*rays) / std::max(1LL, *cycles); });
+        perf.derived(name(), "steps_per_ray", [this, &perf]() {
+            long long steps = 0;
+            for (int i = 0; i < NumTrvs; i++) steps += perf.counter(trv[i]->name(), "steps");
+            return double(steps) / std::max(1LL, *rays);
+        });
+        perf.derived(name(), "backtrack_steps_per_ray", [this, &perf]() {
+            long long backtrack_steps = 0;
+            for (int i = 0; i < NumTrvs; i++) backtrack_steps += perf.counter(trv[i]->name(), "backtrack_steps");
+            return double(backtrack_steps) / std::max(1LL, *rays);
+        });
+        perf.derived(name(), "node_bytes_per_ray", [this, &perf]() {
+            long long node_bytes = 0;
+            for (int i = 0; i < NumTrvs; i++) node_bytes += perf.counter(trv[i]->name(), "node_bytes");
+            return double(node_bytes) / std::max(1LL, *rays);
+        });
+        perf.derived(name(), "trigs_per_ray", [this, &perf]() {
+            return double(perf.counter(ist.name(), "trigs")) / std::max(1LL, *rays);
+        });
+        int stack_entries = RayState::stack_entries(BvhWidth, bvh->instances != nullptr, short_stack_size);
+        RayState::allocate_stacks(ray_states, MaxWorkingRays, stack_entries, stacks);
+        perf.counter(name(), "ray_state_bytes") = RayState::bytes(stack_entries);
+
+        SC_METHOD(count_cycle)
+        sensitive << clk.pos();
+        dont_initialize();
+    }
+
+    int accepted_ray_id() const override { return alloc_ray_id.read(); }
+
+    void count_cycle() {
+        if (srstn) {
+            (*cycles)++;
+            if (m_valid && m_ready) (*rays)++;
+        }
+    }
+
+    ~RTCORE() {
+        for (int i = 0; i < NumTrvs; i++) delete trv[i];
     }
 };
 
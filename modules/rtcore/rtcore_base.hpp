@@ -0,0 +1,27 @@
+#ifndef RTCORE_SYSTEMC_RTCORE_BASE_HPP
+#define RTCORE_SYSTEMC_RTCORE_BASE_HPP
+
+#include "../payloads.hpp"
+
+// ports shared by the cycle-level RTCORE and the loosely-timed RTCORE_LT, so that either can be bound at runtime
+struct RTCORE_BASE : public sc_module {
+    // ports
+    sc_in<bool> s_valid;
+    sc_out<bool> s_ready;
+    sc_in<Ray> s_ray;
+
+    sc_in<bool> clk;
+    sc_in<bool> srstn;
+
+    sc_out<bool> m_valid;
+    sc_in<bool> m_ready;
+    sc_out<RayResult> m_result;
+
+    RTCORE_BASE(const sc_module_name &mn) : sc_module(mn) { }
+
+    // ray id a ray accepted on s in this cycle is given, as in m_result. Read from signals, so it can be sampled at
+    // the rising edge that accepts the ray
+    virtual int accepted_ray_id() const = 0;
+};
+
+#endif //RTCORE_SYSTEMC_RTCORE_BASE_HPP
@@ -0,0 +1,343 @@
+#ifndef RTCORE_SYSTEMC_RTCORE_LT_HPP
+#define RTCORE_SYSTEMC_RTCORE_LT_HPP
+
+#include <cassert>
+#include <deque>
+#include <queue>
+#include <vector>
+#include "../../custom_structs/ray_state.hpp"
+#include "../../custom_structs/perf_counters.hpp"
+#include "../../custom_structs/trace_signals.hpp"
+#include "rtcore_base.hpp"
+
+// loosely-timed RTCORE: a ray is traced in plain C++ when it is accepted, and returned once an approximate latency,
+// derived from the number of traversal steps and triangle batches of the ray, has passed.
+// It gives the same hits as RTCORE; the memory model is not used (fetches have no latency).
+template<int MaxWorkingRays, int NumTrvs = 1, int IstLatency = 1, int IstLanes = 1, int BvhWidth = 2>
+struct RTCORE_LT : public RTCORE_BASE {
+    // approximate cycles, following the states of TRV and the FIFOs of the cycle-level model
+    static constexpr int LOAD_CYCLES = 2;  // IDLE, LOAD
+    static constexpr int STEP_CYCLES = 4;  // BBOX_LOAD, BBOX, NODE_LOAD, STEP
+    static constexpr int LIST_CYCLES = 3;  // STORE, LIST_PREP, LIST
+    static constexpr int RESUME_CYCLES = 3;  // leaf FIFO of LIST, LOAD of LIST, RD working FIFO
+    static constexpr int POST_CYCLES = 2;  // POST_FIFO, output register
+    static constexpr int XFORM_CYCLES = 1;  // XFORM, entering or leaving an instance
+
+    struct Trace {
+        int visits = 0;
+        int steps = 0;
+        int backtrack_steps = 0;
+        int instance_entries = 0;
+        int leaves = 0;
+        int batches = 0;
+        int trigs = 0;
+    };
+
+    struct Done {
+        long long cycle;
+        int ray_id;
+
+        bool operator>(const Done &rhs) const { return cycle != rhs.cycle ? cycle > rhs.cycle : ray_id > rhs.ray_id; }
+    };
+
+    // high-level objects
+    Bvh *bvh;
+    int short_stack_size;  // entries kept per ray, 0 keeps the full stack
+    RayState ray_states[MaxWorkingRays];
+    std::vector<int> stacks;  // of the ray states
+    std::deque<int> free_ray_ids;
+    std::priority_queue<Done, std::vector<Done>, std::greater<Done>> done;
+    long long trv_free_cycle[NumTrvs];
+    long long ist_free_cycle;
+    long long cycle;
+
+    // internal signals
+    sc_signal<int> alloc_ray_id;  // next free ray id, -1 when there is none
+
+    // performance counters
+    long long *cycles;
+    long long *rays;
+    long long *steps;
+    long long *backtrack_steps;
+    long long *instance_entries;
+    long long *trigs;
+
+    SC_HAS_PROCESS(RTCORE_LT);
+    RTCORE_LT(const sc_module_name &mn, Bvh *bvh, int short_stack_size = 0)
+        : RTCORE_BASE(mn), bvh(bvh), short_stack_size(short_stack_size) {
+        PerfCounters &perf = PerfCounters::get();
+        cycles = &perf.counter(name(), "cycles");
+        rays = &perf.counter(name(), "rays");
+        steps = &perf.counter(name(), "steps");
+        backtrack_steps = &perf.counter(name(), "backtrack_steps");
+        instance_entries = &perf.counter(name(), "instance_entries");
+        trigs = &perf.counter(name(), "trigs");
+        perf.derived(name(), "rays_per_cycle", [this]() { return double(*rays) / std::max(1LL, *cycles); });
+        perf.derived(name(), "steps_per_ray", [this]() { return double(*steps) / std::max(1LL, *rays); });
+        perf.derived(name(), "backtrack_steps_per_ray", [this]() {
+            return double(*backtrack_steps) / std::max(1LL, *rays);
+        });
+        perf.derived(name(), "trigs_per_ray", [this]() { return double(*trigs) / std::max(1LL, *rays); });
+        int stack_entries = RayState::stack_entries(BvhWidth, bvh->instances != nullptr, short_stack_size);
+        RayState::allocate_stacks(ray_states, MaxWorkingRays, stack_entries, stacks);
+        perf.counter(name(), "ray_state_bytes") = RayState::bytes(stack_entries);
+
+        TraceSignals &trace = TraceSignals::get();
+        trace.add(name(), "s_valid", s_valid);
+        trace.add(name(), "s_ready", s_ready);
+        trace.add(name(), "s_tag", s_ray, &Ray::tag);
+        trace.add(name(), "s_any_hit", s_ray, &Ray::any_hit);
+        trace.add(name(), "alloc_ray_id", alloc_ray_id);
+        trace.add(name(), "m_valid", m_valid);
+        trace.add(name(), "m_ready", m_ready);
+        trace.add(name(), "m_ray_id", m_result, &RayResult::ray_id);
+        trace.add(name(), "m_tag", m_result, &RayResult::tag);
+        trace.add(name(), "m_hit", m_result, &RayResult::hit);
+        trace.add(name(), "m_hit_trig_idx", m_result, &RayResult::hit_trig_idx);
+        trace.add(name(), "m_hit_instance_idx", m_result, &RayResult::hit_instance_idx);
+        trace.add(name(), "m_t", m_result, &RayResult::t);
+
+        SC_METHOD(main)
+        sensitive << clk.pos();
+        dont_initialize();
+    }
+
+    void main() {
+        if (!srstn) {
+            free_ray_ids.clear();
+            for (int i = 0; i < MaxWorkingRays; i++) free_ray_ids.push_back(i);
+            done = decltype(done)();
+            for (int i = 0; i < NumTrvs; i++) trv_free_cycle[i] = 0;
+            ist_free_cycle = 0;
+            cycle = 0;
+            m_valid = false;
+        } else {
+            cycle++;
+            (*cycles)++;
+
+            bool m_valid_tmp = m_valid;
+            if (m_valid && m_ready) {
+                free_ray_ids.push_back(m_result.read().ray_id);
+                m_valid_tmp = false;
+                (*rays)++;
+            }
+
+            if (s_valid && s_ready) {
+                int ray_id = free_ray_ids.front();
+                free_ray_ids.pop_front();
+                alloc(ray_id);
+                done.push({ cycle + trace(ray_id), ray_id });
+            }
+
+            if (!m_valid_tmp && !done.empty() && done.top().cycle <= cycle) {
+                int ray_id = done.top().ray_id;
+                done.pop();
+                m_valid_tmp = true;
+                const RayState &ray = ray_states[ray_id];
+                m_result = RayResult { ray_id, ray.tag, ray.hit, ray.hit_trig_idx, ray.hit_instance_idx, ray.tmax, ray.u,
+                                       ray.v };
+            }
+            m_valid = m_valid_tmp;
+        }
+
+        s_ready = !free_ray_ids.empty();
+        alloc_ray_id = (free_ray_ids.empty() ? -1 : free_ray_ids.front());
+    }
+
+    int accepted_ray_id() const override { return alloc_ray_id.read(); }
+
+    // same setup as RD
+    void alloc(int ray_id) {
+        const Ray &s = s_ray.read();
+        RayState &ray = ray_states[ray_id];
+        ray.origin_x = s.origin_x;
+        ray.origin_y = s.origin_y;
+        ray.origin_z = s.origin_z;
+        ray.dir_x = s.dir_x;
+        ray.dir_y = s.dir_y;
+        ray.dir_z = s.dir_z;
+        ray.tmax = s.tmax;
+        ray.tag = s.tag;
+        ray.any_hit = s.any_hit;
+        ray.left_node_idx = 1;
+        ray.finished = false;
+        ray.stk_size = 0;
+        ray.stk_dropped = false;
+        ray.backtrack_child = -1;
+        ray.instance_idx = -1;
+        ray.octant_x = s.dir_x < 0;
+        ray.octant_y = s.dir_y < 0;
+        ray.octant_z = s.dir_z < 0;
+        ray.inv_dir_x = 1.f / ((fabsf(s.dir_x) < FLT_EPSILON) ? copysignf(FLT_EPSILON, s.dir_x) : s.dir_x);
+        ray.inv_dir_y = 1.f / ((fabsf(s.dir_y) < FLT_EPSILON) ? copysignf(FLT_EPSILON, s.dir_y) : s.dir_y);
+        ray.inv_dir_z = 1.f / ((fabsf(s.dir_z) < FLT_EPSILON) ? copysignf(FLT_EPSILON, s.dir_z) : s.dir_z);
+        ray.scaled_origin_x = -s.origin_x * ray.inv_dir_x;
+        ray.scaled_origin_y = -s.origin_y * ray.inv_dir_y;
+        ray.scaled_origin_z = -s.origin_z * ray.inv_dir_z;
+        ray.hit = false;
+        ray.hit_instance_idx = -1;
+    }
+
+    // traverses the ray in the order of TRV and returns the cycles until it leaves POST
+    long long trace(int ray_id) {
+        RayState &ray = ray_states[ray_id];
+        Trace tr;
+
+        // cycles a TRV unit spends on the ray and cycles spent waiting for IST, between its visits of a TRV unit
+        long long trv_cycles = 0;
+        long long ist_cycles = 0;
+        bool to_post = false;
+        while (!to_post) {
+            tr.visits++;
+            trv_cycles += LOAD_CYCLES;
+            if (ray.finished || ray.terminated()) break;
+
+            // one visit lasts until leaves are sent to LIST or the ray is finished
+            while (true) {
+                if (ray.crosses_instance()) {
+                    if (ray.left_node_idx < 0) tr.instance_entries++;
+                    ray.cross_instance(bvh);
+                    trv_cycles += XFORM_CYCLES;
+                }
+                tr.steps++;
+                trv_cycles += STEP_CYCLES;
+
+                int left_node_idx = ray.left_node_idx;
+                const Bvh::QuantizedNode *qnode =
+                    (bvh->quantized_nodes ? &bvh->quantized_nodes[(left_node_idx - 1) / BvhWidth] : nullptr);
+                bool hit[BvhWidth];
+                bool is_leaf[BvhWidth];
+                float entry[BvhWidth];
+                int valid_idx[BvhWidth];
+                int num_valid = 0;
+                int num_leaves = 0;
+                for (int i = 0; i < BvhWidth; i++) {
+                    const Bvh::Node &node = bvh->nodes[left_node_idx + i];
+                    hit[i] = intersect_bbox(ray, qnode ? qnode->child_bbox(i) : node.bbox, entry[i]);
+                    is_leaf[i] = node.is_leaf();
+                    if (hit[i] && is_leaf[i]) num_leaves++;
+                    if (!hit[i] || is_leaf[i]) continue;
+                    int j = num_valid++;
+                    for (; j > 0 && entry[valid_idx[j - 1]] > entry[i]; j--) valid_idx[j] = valid_idx[j - 1];
+                    valid_idx[j] = i;
+                }
+
+                int first = 0;
+                if (ray.backtrack_child >= 0) {
+                    while (first < num_valid && valid_idx[first] != ray.backtrack_child) first++;
+                    first++;
+                    num_leaves = 0;
+                    tr.backtrack_steps++;
+                }
+
+                if (first < num_valid) {
+                    for (int j = num_valid - 1; j > first; j--) {
+                        push(ray, bvh->nodes[left_node_idx + valid_idx[j]].left_node_idx);
+                    }
+                    ray.left_node_idx = bvh->nodes[left_node_idx + valid_idx[first]].left_node_idx;
+                    ray.backtrack_child = -1;
+                    ray.finished = false;
+                } else if (ray.stk_size != 0) {
+                    ray.left_node_idx = ray.stk_data[--ray.stk_size];
+                    ray.backtrack_child = -1;
+                    ray.finished = false;
+                } else if (ray.stk_dropped && bvh->parents[(left_node_idx - 1) / BvhWidth] != 0) {
+                    int parent_idx = bvh->parents[(left_node_idx - 1) / BvhWidth];
+                    ray.left_node_idx = (parent_idx - 1) / BvhWidth * BvhWidth + 1;
+                    ray.backtrack_child = (parent_idx - 1) % BvhWidth;
+                    ray.finished = false;
+                } else {
+                    ray.finished = true;
+                }
+
+                if (ray.finished && num_leaves == 0) {
+                    to_post = true;
+                    break;
+                }
+                if (num_leaves > 0) {
+                    // one more LIST cycle per extra pair of leaves
+                    trv_cycles += LIST_CYCLES + (num_leaves - 1) / 2;
+                    for (int i = 0; i < BvhWidth; i++) {
+                        // LIST discards the leaves of a terminated ray
+                        if (hit[i] && is_leaf[i] && !ray.terminated()) intersect_leaf(ray, left_node_idx + i, tr);
+                    }
+                    ist_cycles += RESUME_CYCLES + IstLatency;
+                    break;
+                }
+            }
+        }
+
+        (*steps) += tr.steps;
+        (*backtrack_steps) += tr.backtrack_steps;
+        (*instance_entries) += tr.instance_entries;
+        (*trigs) += tr.trigs;
+
+        // the ray occupies the earliest free TRV unit, and IST for one cycle per batch
+        int trv_idx = 0;
+        for (int i = 1; i < NumTrvs; i++) {
+            if (trv_free_cycle[i] < trv_free_cycle[trv_idx]) trv_idx = i;
+        }
+        long long start_cycle = std::max(cycle, trv_free_cycle[trv_idx]);
+        trv_free_cycle[trv_idx] = start_cycle + trv_cycles;
+        ist_free_cycle = std::max(ist_free_cycle, start_cycle) + tr.batches;
+        long long done_cycle = std::max(start_cycle + trv_cycles + ist_cycles, ist_free_cycle + IstLatency);
+        return done_cycle + POST_CYCLES - cycle;
+    }
+
+    // same as TRV, a full short stack drops its bottom entry
+    void push(RayState &ray, int node_idx) {
+        if (short_stack_size > 0 && ray.stk_size == ray.stk_capacity) {
+            std::copy(ray.stk_data + 1, ray.stk_data + ray.stk_size, ray.stk_data);
+            ray.stk_size--;
+            ray.stk_dropped = true;
+        }
+        assert(ray.stk_size < ray.stk_capacity);
+        ray.stk_data[ray.stk_size++] = node_idx;
+    }
+
+    // same slab test as TRV
+    static bool intersect_bbox(const RayState &ray, const BoundingBox &bbox, float &entry) {
+        const float *bounds = bbox.bounds;
+        float entry_x = ray.inv_dir_x * (ray.octant_x ? bounds[1] : bounds[0]) + ray.scaled_origin_x;
+        float entry_y = ray.inv_dir_y * (ray.octant_y ? bounds[3] : bounds[2]) + ray.scaled_origin_y;
+        float entry_z = ray.inv_dir_z * (ray.octant_z ? bounds[5] : bounds[4]) + ray.scaled_origin_z;
+        float exit_x = ray.inv_dir_x * (ray.octant_x ? bounds[0] : bounds[1]) + ray.scaled_origin_x;
+        float exit_y = ray.inv_dir_y * (ray.octant_y ? bounds[2] : bounds[3]) + ray.scaled_origin_y;
+        float exit_z = ray.inv_dir_z * (ray.octant_z ? bounds[4] : bounds[5]) + ray.scaled_origin_z;
+        entry = fmaxf(entry_x, fmaxf(entry_y, entry_z));
+        return entry <= fminf(exit_x, fminf(exit_y, exit_z));
+    }
+
+    // same test as IST, the triangles of a leaf are tested in order
+    void intersect_leaf(RayState &ray, int node_idx, Trace &tr) {
+        int first_trig_idx = bvh->nodes[node_idx].first_trig_idx;
+        int num_trigs = bvh->nodes[node_idx].num_trigs;
+        tr.leaves++;
+        tr.batches += (num_trigs + IstLanes - 1) / IstLanes;
+        tr.trigs += num_trigs;
+
+        Vec3 origin(ray.origin_x, ray.origin_y, ray.origin_z);
+        Vec3 dir(ray.dir_x, ray.dir_y, ray.dir_z);
+        for (int trig_idx = first_trig_idx; trig_idx < first_trig_idx + num_trigs; trig_idx++) {
+            // as in IST, an any-hit ray keeps its first hit
+            if (ray.terminated()) break;
+            const Triangle &trig = bvh->triangles[trig_idx];
+            Vec3 c = trig.p0 - origin;
+            Vec3 r = cross(dir, c);
+            float inv_det = 1.f / dot(dir, trig.n);
+            float u = inv_det * dot(trig.e2, r);
+            float v = inv_det * dot(trig.e1, r);
+            float t = inv_det * dot(c, trig.n);
+            if (u >= 0.0f && v >= 0.0f && (u + v) <= 1.0f && 0 < t && t <= ray.tmax) {
+                ray.tmax = t;
+                ray.hit = true;
+                ray.hit_trig_idx = trig_idx;
+                ray.hit_instance_idx = ray.instance_idx;
+                ray.u = u;
+                ray.v = v;
+            }
+        }
+    }
+};
+
+#endif //RTCORE_SYSTEMC_RTCORE_LT_HPP
@@ -1,8 +1,11 @@
 #ifndef RTCORE_SYSTEMC_TRV_HPP
 #define RTCORE_SYSTEMC_TRV_HPP
 
+#include <cassert>
+
+// tests the Width child boxes of a node per step, Width = 2 for the binary BVH and 4 or 8 for Bvh::collapse()
 // TODO: this TRV unit works only when the root node of the BVH is not leaf
-template<int MaxWorkingRays>
+template<int Width>
 SC_MODULE(TRV) {
     // state definitions
     static constexpr int IDLE = 0;
@@ -15,6 +18,73 @@ SC_MODULE(TRV) {
     static constexpr int LIST_PREP = 7;
     static constexpr int LIST = 8;
     static constexpr int POST = 9;
+    static constexpr int XFORM = 10;  // enters or leaves an instance of a two-level BVH
+    static constexpr int NUM_STATES = 11;
+    static constexpr const char *STATE_NAMES[NUM_STATES] = {
+        "IDLE", "LOAD", "BBOX_LOAD", "BBOX", "NODE_LOAD", "STEP", "STORE", "LIST_PREP", "LIST", "POST", "XFORM"
+    };
+
+    // ray data for ray-AABB intersection, from the ray state
+    struct BoxRay {
+        bool octant_x;
+        bool octant_y;
+        bool octant_z;
+        float inv_dir_x;
+        float inv_dir_y;
+        float inv_dir_z;
+        float scaled_origin_x;
+        float scaled_origin_y;
+        float scaled_origin_z;
+
+        bool operator==(const BoxRay &rhs) const {
+            return octant_x == rhs.octant_x && octant_y == rhs.octant_y && octant_z == rhs.octant_z
+                   && inv_dir_x == rhs.inv_dir_x && inv_dir_y == rhs.inv_dir_y && inv_dir_z == rhs.inv_dir_z
+                   && scaled_origin_x == rhs.scaled_origin_x && scaled_origin_y == rhs.scaled_origin_y
+                   && scaled_origin_z == rhs.scaled_origin_z;
+        }
+
+        friend std::ostream &operator<<(std::ostream &os, const BoxRay &ray) {
+            return os << "inv_dir (" << ray.inv_dir_x << ", " << ray.inv_dir_y << ", " << ray.inv_dir_z
+                      << "), scaled_origin (" << ray.scaled_origin_x << ", " << ray.scaled_origin_y << ", "
+                      << ray.scaled_origin_z << ")";
+        }
+
+        friend void sc_trace(sc_trace_file *tf, const BoxRay &ray, const std::string &name) {
+            sc_trace(tf, ray.inv_dir_x, name + ".inv_dir_x");
+            sc_trace(tf, ray.inv_dir_y, name + ".inv_dir_y");
+            sc_trace(tf, ray.inv_dir_z, name + ".inv_dir_z");
+            sc_trace(tf, ray.scaled_origin_x, name + ".scaled_origin_x");
+            sc_trace(tf, ray.scaled_origin_y, name + ".scaled_origin_y");
+            sc_trace(tf, ray.scaled_origin_z, name + ".scaled_origin_z");
+        }
+    };
+
+    // a child of the group, fetched in BBOX_LOAD and tested in BBOX
+    struct Child {
+        float bounds[6];  // [xmin, xmax, ymin, ymax, zmin, zmax]
+        bool is_leaf;
+        bool hit;
+        float entry;
+
+        bool operator==(const Child &rhs) const {
+            return std::equal(bounds, bounds + 6, rhs.bounds) && is_leaf == rhs.is_leaf && hit == rhs.hit
+                   && entry == rhs.entry;
+        }
+
+        friend std::ostream &operator<<(std::ostream &os, const Child &child) {
+            os << "[";
+            for (int i = 0; i < 6; i++) os << (i > 0 ? ", " : "") << child.bounds[i];
+            return os << "]" << (child.is_leaf ? ", leaf" : "") << (child.hit ? ", hit at " : ", missed at ")
+                      << child.entry;
+        }
+
+        friend void sc_trace(sc_trace_file *tf, const Child &child, const std::string &name) {
+            for (int i = 0; i < 6; i++) sc_trace(tf, child.bounds[i], name + ".bounds_" + std::to_string(i));
+            sc_trace(tf, child.is_leaf, name + ".is_leaf");
+            sc_trace(tf, child.hit, name + ".hit");
+            sc_trace(tf, child.entry, name + ".entry");
+        }
+    };
 
     // ports
     sc_in<bool> s_valid;
@@ -24,12 +94,10 @@ SC_MODULE(TRV) {
     sc_in<bool> clk;
     sc_in<bool> srstn;
 
+    // the hit leaves of a step are sent in pairs
     sc_out<bool> m_list_valid;
     sc_in<bool> m_list_ready;
-    sc_out<int> m_list_ray_id;
-    sc_out<int> m_list_node_a_idx;
-    sc_out<bool> m_list_node_b_valid;
-    sc_out<int> m_list_node_b_idx;
+    sc_out<LeafPair> m_list_pair;
 
     sc_out<bool> m_post_valid;
     sc_in<bool> m_post_ready;
@@ -38,60 +106,82 @@ SC_MODULE(TRV) {
     // high-level objects
     Bvh *bvh;
     RayState *ray_states;
+    Memory *mem;  // nullptr when node fetches have no latency
+    int short_stack_size;  // entries kept per ray, 0 keeps the full stack
 
     // internal signals
     sc_signal<int> state;
     sc_signal<int> ray_id;
 
     // LOAD
-    sc_signal<int> left_node_idx;
-    sc_signal<int> right_node_idx;
-    sc_signal<bool> octant_x;
-    sc_signal<bool> octant_y;
-    sc_signal<bool> octant_z;
-    sc_signal<float> inv_dir_x;
-    sc_signal<float> inv_dir_y;
-    sc_signal<float> inv_dir_z;
-    sc_signal<float> scaled_origin_x;
-    sc_signal<float> scaled_origin_y;
-    sc_signal<float> scaled_origin_z;
-
-    // BBOX_LOAD
-    sc_signal<float> left_bound_x_min;
-    sc_signal<float> left_bound_x_max;
-    sc_signal<float> left_bound_y_min;
-    sc_signal<float> left_bound_y_max;
-    sc_signal<float> left_bound_z_min;
-    sc_signal<float> left_bound_z_max;
-    sc_signal<bool> left_is_leaf;
-    sc_signal<float> right_bound_x_min;
-    sc_signal<float> right_bound_x_max;
-    sc_signal<float> right_bound_y_min;
-    sc_signal<float> right_bound_y_max;
-    sc_signal<float> right_bound_z_min;
-    sc_signal<float> right_bound_z_max;
-    sc_signal<bool> right_is_leaf;
-
-    // BBOX
-    sc_signal<bool> left_hit;
-    sc_signal<bool> right_hit;
-    sc_signal<float> left_entry;
-    sc_signal<float> right_entry;
+    sc_signal<int> left_node_idx;  // first child of the node
+    sc_signal<BoxRay> box_ray;
+
+    // BBOX_LOAD, BBOX
+    sc_signal<Child> child[Width];
 
     // NODE_LOAD
-    sc_signal<int> left_node_left_node_idx;
-    sc_signal<int> right_node_left_node_idx;
+    sc_signal<int> child_left_node_idx[Width];
 
     // STEP
     sc_signal<int> old_left_node_idx;
-    sc_signal<int> old_right_node_idx;
-    sc_signal<int> stk_size[MaxWorkingRays];
-    sc_signal<int> stk_data[MaxWorkingRays][Bvh::BVH_MAX_DEPTH - 1];
     sc_signal<int> finished;
 
+    // LIST_PREP
+    sc_signal<int> list_node_idx[Width];
+    sc_signal<int> num_list_nodes;
+    sc_signal<int> next_list_node;
+
+    // internal states
+    int mem_stall;  // cycles until the fetch of BBOX_LOAD or XFORM arrives, not a signal as it changes every cycle
+
+    // performance counters
+    long long *idle_cycles;  // no ray to traverse
+    long long *busy_cycles[NUM_STATES];
+    long long *stalled_cycles[NUM_STATES];  // waiting for memory, LIST or POST
+    long long *rays;
+    long long *steps;
+    long long *node_bytes;  // bytes of the child groups fetched
+    long long *max_stack_size;
+    long long *dropped_entries;  // pushes to a full short stack
+    long long *backtrack_steps;  // steps revisiting a group while backtracking
+    long long *instance_entries;
+
     SC_HAS_PROCESS(TRV);
-    TRV(const sc_module_name &mn, Bvh *bvh, RayState *ray_states)
-        : sc_module(mn), bvh(bvh), ray_states(ray_states) {
+    TRV(const sc_module_name &mn, Bvh *bvh, RayState *ray_states, Memory *mem, int short_stack_size)
+        : sc_module(mn), bvh(bvh), ray_states(ray_states), mem(mem), short_stack_size(short_stack_size),
+          mem_stall(0) {
+        PerfCounters &perf = PerfCounters::get();
+        idle_cycles = &perf.counter(name(), "idle_cycles");
+        for (int i = 0; i < NUM_STATES; i++) {
+            busy_cycles[i] = &perf.counter(name(), std::string(STATE_NAMES[i]) + ".busy_cycles");
+            stalled_cycles[i] = &perf.counter(name(), std::string(STATE_NAMES[i]) + ".stalled_cycles");
+        }
+        rays = &perf.counter(name(), "rays");
+        steps = &perf.counter(name(), "steps");
+        node_bytes = &perf.counter(name(), "node_bytes");
+        max_stack_size = &perf.counter(name(), "max_stack_size");
+        dropped_entries = &perf.counter(name(), "dropped_entries");
+        backtrack_steps = &perf.counter(name(), "backtrack_steps");
+        instance_entries = &perf.counter(name(), "instance_entries");
+
+        TraceSignals &trace = TraceSignals::get();
+        trace.add(name(), "state", state);
+        trace.add(name(), "ray_id", ray_id);
+        trace.add(name(), "s_valid", s_valid);
+        trace.add(name(), "s_ready", s_ready);
+        trace.add(name(), "s_ray_id", s_ray_id);
+        trace.add(name(), "m_list_valid", m_list_valid);
+        trace.add(name(), "m_list_ready", m_list_ready);
+        trace.add(name(), "m_list_ray_id", m_list_pair, &LeafPair::ray_id);
+        trace.add(name(), "m_list_node_a_idx", m_list_pair, &LeafPair::node_a_idx);
+        trace.add(name(), "m_list_node_b_valid", m_list_pair, &LeafPair::node_b_valid);
+        trace.add(name(), "m_list_node_b_idx", m_list_pair, &LeafPair::node_b_idx);
+        trace.add(name(), "m_list_is_last_pair", m_list_pair, &LeafPair::is_last_pair);
+        trace.add(name(), "m_post_valid", m_post_valid);
+        trace.add(name(), "m_post_ready", m_post_ready);
+        trace.add(name(), "m_post_ray_id", m_post_ray_id);
+
         SC_METHOD(main)
         sensitive << clk.pos();
         dont_initialize();
@@ -102,25 +192,19 @@ SC_MODULE(TRV) {
         SC_METHOD(update_m_list_valid)
         sensitive << state;
 
-        SC_METHOD(update_m_list_ray_id)
-        sensitive << ray_id;
-
         SC_METHOD(update_m_pf_valid)
         sensitive << state;
 
         SC_METHOD(update_m_pf_ray_id)
         sensitive << ray_id;
-
-        SC_METHOD(update_right_node_idx)
-        sensitive << left_node_idx;
-
-        SC_METHOD(update_old_right_node_idx)
-        sensitive << old_left_node_idx;
     }
 
     void main() {
         if (!srstn) {
             state = IDLE;
+            mem_stall = 0;
+        } else {
+            count_cycle();
         } if (state == IDLE) {
             ray_id = s_ray_id;
 
@@ -128,111 +212,128 @@ SC_MODULE(TRV) {
             if (s_valid) state = LOAD;
         } else if (state == LOAD) {
             left_node_idx = ray_states[ray_id].left_node_idx;
-            octant_x = ray_states[ray_id].octant_x;
-            octant_y = ray_states[ray_id].octant_y;
-            octant_z = ray_states[ray_id].octant_z;
-            inv_dir_x = ray_states[ray_id].inv_dir_x;
-            inv_dir_y = ray_states[ray_id].inv_dir_y;
-            inv_dir_z = ray_states[ray_id].inv_dir_z;
-            scaled_origin_x = ray_states[ray_id].scaled_origin_x;
-            scaled_origin_y = ray_states[ray_id].scaled_origin_y;
-            scaled_origin_z = ray_states[ray_id].scaled_origin_z;
+            box_ray = box_ray_of(ray_states[ray_id]);
+            (*rays)++;
 
             // update state
-            if (ray_states[ray_id].finished) state = POST;
+            if (ray_states[ray_id].finished || ray_states[ray_id].terminated()) state = POST;
+            else if (ray_states[ray_id].crosses_instance()) state = XFORM;
             else state = BBOX_LOAD;
         } else if (state == BBOX_LOAD) {
-            float *left_bounds = bvh->nodes[left_node_idx].bbox.bounds;
-            left_bound_x_min = left_bounds[0];
-            left_bound_x_max = left_bounds[1];
-            left_bound_y_min = left_bounds[2];
-            left_bound_y_max = left_bounds[3];
-            left_bound_z_min = left_bounds[4];
-            left_bound_z_max = left_bounds[5];
-            left_is_leaf = bvh->nodes[left_node_idx].is_leaf();
-
-            float *right_bounds = bvh->nodes[right_node_idx].bbox.bounds;
-            right_bound_x_min = right_bounds[0];
-            right_bound_x_max = right_bounds[1];
-            right_bound_y_min = right_bounds[2];
-            right_bound_y_max = right_bounds[3];
-            right_bound_z_min = right_bounds[4];
-            right_bound_z_max = right_bounds[5];
-            right_is_leaf = bvh->nodes[right_node_idx].is_leaf();
+            // the child group is fetched once (it also holds the data for NODE_LOAD), stall until it arrives
+            const Bvh::QuantizedNode *qnode = quantized_node();
+            if (mem_stall == 0) {
+                int latency = 0;
+                if (mem) latency = (qnode ? mem->read_quantized_node(group_idx(), Width)
+                                          : mem->read_nodes(left_node_idx, Width));
+                if (latency > 0) {
+                    mem_stall = latency;
+                    return;
+                }
+            } else if (mem_stall > 1) {
+                mem_stall = mem_stall - 1;
+                return;
+            }
+            mem_stall = 0;
+            (*node_bytes) += (qnode ? Bvh::QuantizedNode::bytes(Width) : Width * sizeof(Bvh::Node));
+
+            for (int i = 0; i < Width; i++) {
+                // quantized bounds are decoded outwards, so a box can only grow
+                BoundingBox bbox = (qnode ? qnode->child_bbox(i) : bvh->nodes[left_node_idx + i].bbox);
+                Child child_tmp = child[i];
+                std::copy(bbox.bounds, bbox.bounds + 6, child_tmp.bounds);
+                child_tmp.is_leaf = (qnode ? qnode->is_leaf(i) : bvh->nodes[left_node_idx + i].is_leaf());
+                child[i] = child_tmp;
+            }
 
             // update state
             state = BBOX;
         } else if (state == BBOX) {
-            float left_entry_x = inv_dir_x * (octant_x ? left_bound_x_max : left_bound_x_min) + scaled_origin_x;
-            float left_entry_y = inv_dir_y * (octant_y ? left_bound_y_max : left_bound_y_min) + scaled_origin_y;
-            float left_entry_z = inv_dir_z * (octant_z ? left_bound_z_max : left_bound_z_min) + scaled_origin_z;
-            float left_entry_tmp = fmaxf(left_entry_x, fmaxf(left_entry_y, left_entry_z));
-            float left_exit_x = inv_dir_x * (octant_x ? left_bound_x_min : left_bound_x_max) + scaled_origin_x;
-            float left_exit_y = inv_dir_y * (octant_y ? left_bound_y_min : left_bound_y_max) + scaled_origin_y;
-            float left_exit_z = inv_dir_z * (octant_z ? left_bound_z_min : left_bound_z_max) + scaled_origin_z;
-            float left_exit = fminf(left_exit_x, fminf(left_exit_y, left_exit_z));
-
-            left_hit = left_entry_tmp <= left_exit;
-            left_entry = left_entry_tmp;
-
-            float right_entry_x = inv_dir_x * (octant_x ? right_bound_x_max : right_bound_x_min) + scaled_origin_x;
-            float right_entry_y = inv_dir_y * (octant_y ? right_bound_y_max : right_bound_y_min) + scaled_origin_y;
-            float right_entry_z = inv_dir_z * (octant_z ? right_bound_z_max : right_bound_z_min) + scaled_origin_z;
-            float right_entry_tmp = fmaxf(right_entry_x, fmaxf(right_entry_y, right_entry_z));
-            float right_exit_x = inv_dir_x * (octant_x ? right_bound_x_min : right_bound_x_max) + scaled_origin_x;
-            float right_exit_y = inv_dir_y * (octant_y ? right_bound_y_min : right_bound_y_max) + scaled_origin_y;
-            float right_exit_z = inv_dir_z * (octant_z ? right_bound_z_min : right_bound_z_max) + scaled_origin_z;
-            float right_exit = fminf(right_exit_x, fminf(right_exit_y, right_exit_z));
-
-            right_hit = right_entry_tmp <= right_exit;
-            right_entry = right_entry_tmp;
+            const BoxRay &ray = box_ray.read();
+            for (int i = 0; i < Width; i++) {
+                Child child_tmp = child[i];
+                const float *bounds = child_tmp.bounds;
+                float entry_x = ray.inv_dir_x * (ray.octant_x ? bounds[1] : bounds[0]) + ray.scaled_origin_x;
+                float entry_y = ray.inv_dir_y * (ray.octant_y ? bounds[3] : bounds[2]) + ray.scaled_origin_y;
+                float entry_z = ray.inv_dir_z * (ray.octant_z ? bounds[5] : bounds[4]) + ray.scaled_origin_z;
+                float entry_tmp = fmaxf(entry_x, fmaxf(entry_y, entry_z));
+                float exit_x = ray.inv_dir_x * (ray.octant_x ? bounds[0] : bounds[1]) + ray.scaled_origin_x;
+                float exit_y = ray.inv_dir_y * (ray.octant_y ? bounds[2] : bounds[3]) + ray.scaled_origin_y;
+                float exit_z = ray.inv_dir_z * (ray.octant_z ? bounds[4] : bounds[5]) + ray.scaled_origin_z;
+                float exit = fminf(exit_x, fminf(exit_y, exit_z));
+
+                child_tmp.hit = entry_tmp <= exit;
+                child_tmp.entry = entry_tmp;
+                child[i] = child_tmp;
+            }
 
             // update state
             state = NODE_LOAD;
         } else if (state == NODE_LOAD) {
-            left_node_left_node_idx = bvh->nodes[left_node_idx].left_node_idx;
-            right_node_left_node_idx = bvh->nodes[right_node_idx].left_node_idx;
+            const Bvh::QuantizedNode *qnode = quantized_node();
+            for (int i = 0; i < Width; i++) {
+                child_left_node_idx[i] = (qnode ? qnode->child_idx[i] : bvh->nodes[left_node_idx + i].left_node_idx);
+            }
 
             // update state
             state = STEP;
         } else if (state == STEP) {
             old_left_node_idx = left_node_idx;
-
-            bool left_valid = left_hit && !left_is_leaf;
-            bool right_valid = right_hit && !right_is_leaf;
-            if (left_valid) {
-                if (right_valid) {
-                    if (left_entry > right_entry) {
-                        stk_data[ray_id][stk_size[ray_id]] = left_node_left_node_idx;
-                        stk_size[ray_id] = stk_size[ray_id] + 1;
-                        left_node_idx = right_node_left_node_idx;
-                        finished = false;
-                    } else {
-                        stk_data[ray_id][stk_size[ray_id]] = right_node_left_node_idx;
-                        stk_size[ray_id] = stk_size[ray_id] + 1;
-                        left_node_idx = left_node_left_node_idx;
-                        finished = false;
-                    }
-                } else {
-                    left_node_idx = left_node_left_node_idx;
-                    finished = false;
+            (*steps)++;
+
+            // the traversal stack is part of the ray state, so a ray can resume on any TRV unit
+            RayState &ray = ray_states[ray_id];
+
+            // sort the hit inner children by entry distance, ties keep the child order
+            int valid_idx[Width];
+            int num_valid = 0;
+            bool any_leaf_hit = false;
+            for (int i = 0; i < Width; i++) {
+                const Child &child_i = child[i].read();
+                any_leaf_hit |= (child_i.hit && child_i.is_leaf);
+                if (!child_i.hit || child_i.is_leaf) continue;
+                int j = num_valid++;
+                for (; j > 0 && child[valid_idx[j - 1]].read().entry > child_i.entry; j--) {
+                    valid_idx[j] = valid_idx[j - 1];
                 }
-            } else if (right_valid) {
-                left_node_idx = right_node_left_node_idx;
-                finished = false;
+                valid_idx[j] = i;
+            }
+
+            // when backtracking, the children up to the one the ray returns from are done,
+            // and the leaves were sent on the first visit of the group
+            int first = 0;
+            if (ray.backtrack_child >= 0) {
+                while (first < num_valid && valid_idx[first] != ray.backtrack_child) first++;
+                first++;
+                any_leaf_hit = false;
+                (*backtrack_steps)++;
+            }
+
+            bool finished_tmp = false;
+            if (first < num_valid) {
+                // visit the nearest child next and push the others, the farthest first
+                for (int j = num_valid - 1; j > first; j--) push(ray, child_left_node_idx[valid_idx[j]]);
+                ray.left_node_idx = child_left_node_idx[valid_idx[first]];
+                ray.backtrack_child = -1;
+            } else if (ray.stk_size != 0) {
+                ray.left_node_idx = ray.stk_data[--ray.stk_size];
+                ray.backtrack_child = -1;
+            } else if (ray.stk_dropped && bvh->parents[group_idx()] != 0) {
+                // the dropped entries are siblings of the ancestors, continue from the group holding the parent
+                int parent_idx = bvh->parents[group_idx()];
+                ray.left_node_idx = (parent_idx - 1) / Width * Width + 1;
+                ray.backtrack_child = (parent_idx - 1) % Width;
             } else {
-                if (stk_size[ray_id] != 0) {
-                    left_node_idx = stk_data[ray_id][stk_size[ray_id] - 1];
-                    stk_size[ray_id] = stk_size[ray_id] - 1;
-                    finished = false;
-                } else {
-                    finished = true;
-                }
+                finished_tmp = true;
             }
+            left_node_idx = ray.left_node_idx;
+            finished = finished_tmp;
+            *max_stack_size = std::max(*max_stack_size, (long long)ray.stk_size);
 
             // update state
-            if (!left_hit && !right_hit && stk_size[ray_id] == 0) state = POST;
-            else if ((left_hit && left_is_leaf) || (right_hit && right_is_leaf)) state = STORE;
+            if (finished_tmp && !any_leaf_hit) state = POST;
+            else if (any_leaf_hit) state = STORE;
+            else if (ray.crosses_instance()) state = XFORM;
             else state = BBOX_LOAD;
         } else if (state == STORE) {
             ray_states[ray_id].left_node_idx = left_node_idx;
@@ -241,29 +342,92 @@ SC_MODULE(TRV) {
             // update state
             state = LIST_PREP;
         } else if (state == LIST_PREP) {
-            if (left_hit && left_is_leaf) {
-                if (right_hit && right_is_leaf) {
-                    m_list_node_a_idx = old_left_node_idx;
-                    m_list_node_b_valid = true;
-                    m_list_node_b_idx = old_right_node_idx;
-                } else {
-                    m_list_node_a_idx = old_left_node_idx;
-                    m_list_node_b_valid = false;
-                }
-            } else {
-                m_list_node_a_idx = old_right_node_idx;
-                m_list_node_b_valid = false;
+            int leaf_idx[Width];
+            int num_leaves = 0;
+            for (int i = 0; i < Width; i++) {
+                if (child[i].read().hit && child[i].read().is_leaf) leaf_idx[num_leaves++] = old_left_node_idx + i;
             }
+            for (int i = 0; i < num_leaves; i++) list_node_idx[i] = leaf_idx[i];
+            num_list_nodes = num_leaves;
+            next_list_node = 2;
+
+            m_list_pair = LeafPair { ray_id, leaf_idx[0], num_leaves > 1, leaf_idx[num_leaves > 1 ? 1 : 0],
+                                     num_leaves <= 2 };
 
             // update state
             state = LIST;
         } else if (state == LIST) {
-            // update state
-            if (m_list_ready) state = IDLE;
+            if (m_list_ready && next_list_node < num_list_nodes) {
+                // send the next pair of leaves, only wide nodes have more than two
+                bool node_b_valid = (next_list_node + 1 < num_list_nodes);
+                m_list_pair = LeafPair { ray_id, list_node_idx[next_list_node], node_b_valid,
+                                         list_node_idx[node_b_valid ? next_list_node + 1 : next_list_node],
+                                         next_list_node + 2 >= num_list_nodes };
+                next_list_node = next_list_node + 2;
+            } else if (m_list_ready) {
+                // update state
+                state = IDLE;
+            }
         } else if (state == POST) {
             // update state
             if (m_post_ready) state = IDLE;
+        } else if (state == XFORM) {
+            // entering an instance fetches its record, stall until it arrives
+            RayState &ray = ray_states[ray_id];
+            if (left_node_idx < 0 && mem_stall == 0) {
+                int latency = (mem ? mem->read_instance(-1 - left_node_idx) : 0);
+                if (latency > 0) {
+                    mem_stall = latency;
+                    return;
+                }
+            } else if (mem_stall > 1) {
+                mem_stall = mem_stall - 1;
+                return;
+            }
+            mem_stall = 0;
+            if (left_node_idx < 0) (*instance_entries)++;
+
+            ray.cross_instance(bvh);
+            left_node_idx = ray.left_node_idx;
+            box_ray = box_ray_of(ray);
+
+            // update state
+            state = BBOX_LOAD;
+        }
+    }
+
+    static BoxRay box_ray_of(const RayState &ray) {
+        return BoxRay { ray.octant_x != 0.f, ray.octant_y != 0.f, ray.octant_z != 0.f, ray.inv_dir_x, ray.inv_dir_y,
+                        ray.inv_dir_z, ray.scaled_origin_x, ray.scaled_origin_y, ray.scaled_origin_z };
+    }
+
+    // index of the child group at left_node_idx in quantized_nodes and parents
+    int group_idx() const {
+        return (left_node_idx - 1) / Width;
+    }
+
+    // pushes to the stack of the ray, a full short stack drops its bottom entry
+    void push(RayState &ray, int node_idx) {
+        if (short_stack_size > 0 && ray.stk_size == ray.stk_capacity) {
+            std::copy(ray.stk_data + 1, ray.stk_data + ray.stk_size, ray.stk_data);
+            ray.stk_size--;
+            ray.stk_dropped = true;
+            (*dropped_entries)++;
         }
+        assert(ray.stk_size < ray.stk_capacity);
+        ray.stk_data[ray.stk_size++] = node_idx;
+    }
+
+    // nullptr when the BVH is not quantized
+    const Bvh::QuantizedNode *quantized_node() const {
+        return (bvh->quantized_nodes ? &bvh->quantized_nodes[group_idx()] : nullptr);
+    }
+
+    void count_cycle() {
+        if (state == IDLE && !s_valid) (*idle_cycles)++;
+        else if (((state == BBOX_LOAD || state == XFORM) && mem_stall != 0) || (state == LIST && !m_list_ready)
+                 || (state == POST && !m_post_ready)) (*stalled_cycles[state])++;
+        else (*busy_cycles[state])++;
     }
 
     void update_s_ready() {
@@ -274,10 +438,6 @@ SC_MODULE(TRV) {
         m_list_valid = (state == LIST);
     }
 
-    void update_m_list_ray_id() {
-        m_list_ray_id = ray_id;
-    }
-
     void update_m_pf_valid() {
         m_post_valid = (state == POST);
     }
@@ -285,14 +445,6 @@ SC_MODULE(TRV) {
     void update_m_pf_ray_id() {
         m_post_ray_id = ray_id;
     }
-
-    void update_right_node_idx() {
-        right_node_idx = left_node_idx + 1;
-    }
-
-    void update_old_right_node_idx() {
-        old_right_node_idx = old_left_node_idx + 1;
-    }
 };
 
 #endif //RTCORE_SYSTEMC_TRV_HPP
@@ -0,0 +1,55 @@
+#ifndef RTCORE_SYSTEMC_TRV_DISPATCH_HPP
+#define RTCORE_SYSTEMC_TRV_DISPATCH_HPP
+
+// hands rays from the working FIFO of RD to the lowest-indexed idle TRV unit
+template<int NumTrvs>
+SC_MODULE(TRV_DISPATCH) {
+    // ports
+    sc_in<bool> s_valid;
+    sc_out<bool> s_ready;
+    sc_in<int> s_ray_id;
+
+    sc_out<bool> m_valid[NumTrvs];
+    sc_in<bool> m_ready[NumTrvs];
+    sc_out<int> m_ray_id[NumTrvs];
+
+    // internal signals
+    sc_signal<int> select;
+
+    SC_HAS_PROCESS(TRV_DISPATCH);
+    TRV_DISPATCH(const sc_module_name &mn) : sc_module(mn) {
+        SC_METHOD(update_select)
+        for (int i = 0; i < NumTrvs; i++) sensitive << m_ready[i];
+
+        SC_METHOD(update_s_ready)
+        sensitive << select;
+
+        SC_METHOD(update_m_valid)
+        sensitive << s_valid << select;
+
+        SC_METHOD(update_m_ray_id)
+        sensitive << s_ray_id;
+    }
+
+    void update_select() {
+        int select_tmp = -1;
+        for (int i = NumTrvs - 1; i >= 0; i--) {
+            if (m_ready[i]) select_tmp = i;
+        }
+        select = select_tmp;
+    }
+
+    void update_s_ready() {
+        s_ready = (select != -1);
+    }
+
+    void update_m_valid() {
+        for (int i = 0; i < NumTrvs; i++) m_valid[i] = (s_valid && select == i);
+    }
+
+    void update_m_ray_id() {
+        for (int i = 0; i < NumTrvs; i++) m_ray_id[i] = s_ray_id;
+    }
+};
+
+#endif //RTCORE_SYSTEMC_TRV_DISPATCH_HPP
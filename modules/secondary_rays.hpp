@@ -0,0 +1,190 @@
+#ifndef RTCORE_SYSTEMC_SECONDARY_RAYS_HPP
+#define RTCORE_SYSTEMC_SECONDARY_RAYS_HPP
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "../custom_structs/config.hpp"
+#include "../custom_structs/perf_counters.hpp"
+
+// a ray spawned at a hit point, fed back to RTCORE by RAYGEN
+struct SpawnedRay {
+    static constexpr int SHADOW = 0;
+    static constexpr int AO = 1;
+    static constexpr int DIFFUSE = 2;
+
+    int pixel_idx;
+    int type;
+    int depth;  // 1 for the rays spawned at the primary hit, one more per diffuse bounce
+    Vec3 origin;
+    Vec3 dir;
+    float tmax;
+    bool any_hit;
+};
+
+// secondary-ray workload: SHADER spawns shadow, AO and diffuse rays at the hits of primary rays and diffuse paths,
+// RAYGEN sends them before new primary rays, and their results are accumulated per pixel into secondary.txt.
+// Tags below the number of pixels are the pixels of primary rays, the others index the spawned rays.
+// Directions are drawn from a hash of the pixel, type, depth and sample, so results do not depend on timing.
+struct SecondaryRays {
+    SecondaryRays(const Config *config, const Bvh *bvh);
+    ~SecondaryRays();
+
+    bool is_spawned(int tag) const { return tag >= num_pixels; }
+    const SpawnedRay &ray(int tag) const { return rays[tag - num_pixels]; }
+
+    // spawns the rays at the hit of a ray of the pixel, depth is the depth of that ray
+    void spawn(int pixel_idx, int depth, const Vec3 &origin, const Vec3 &dir, int hit_instance_idx, int hit_trig_idx,
+               float t);
+
+    // accumulates the result of a spawned ray, continues its diffuse path and frees its tag
+    void retire(int tag, bool hit, int hit_instance_idx, int hit_trig_idx, float t);
+
+    // per-pixel results of a worker process, added up by the parent since each worker only shades its own pixels
+    void write_results(std::ostream &os) const;
+    bool merge_results(std::istream &is);
+
+    const Config *config;
+    const Bvh *bvh;
+    int num_pixels;
+    float offset;  // hit points are moved off the surface by this distance
+    std::deque<int> queue;  // tags of the rays waiting for RAYGEN
+    std::vector<SpawnedRay> rays;
+    std::vector<int> free_tags;
+
+    // per-pixel results
+    std::vector<int> lit;  // 1 when the shadow ray of the primary hit reached the light
+    std::vector<int> ao_unoccluded;  // AO rays that hit nothing
+    std::vector<int> path_length;  // diffuse bounces that hit the scene
+
+    // performance counters
+    long long *shadow_rays;
+    long long *ao_rays;
+    long long *diffuse_rays;
+    long long *max_queue_size;
+
+private:
+    void push(const SpawnedRay &ray);
+    Vec3 sample_hemisphere(const Vec3 &n, int pixel_idx, int type, int depth, int sample) const;
+};
+
+SecondaryRays::SecondaryRays(const Config *config, const Bvh *bvh)
+    : config(config), bvh(bvh), num_pixels(config->width * config->height), lit(num_pixels),
+      ao_unoccluded(num_pixels), path_length(num_pixels) {
+    const float *bounds = bvh->nodes[0].bbox.bounds;
+    Vec3 diagonal(bounds[1] - bounds[0], bounds[3] - bounds[2], bounds[5] - bounds[4]);
+    offset = 1e-5f * sqrtf(dot(diagonal, diagonal));
+
+    PerfCounters &perf = PerfCounters::get();
+    shadow_rays = &perf.counter("secondary_rays", "shadow_rays");
+    ao_rays = &perf.counter("secondary_rays", "ao_rays");
+    diffuse_rays = &perf.counter("secondary_rays", "diffuse_rays");
+    max_queue_size = &perf.counter("secondary_rays", "max_queue_size");
+}
+
+SecondaryRays::~SecondaryRays() {
+    std::ofstream secondary_file("secondary.txt");
+    for (int i = 0; i < num_pixels; i++) secondary_file << lit[i] << ' ' << ao_unoccluded[i] << ' ' << path_length[i] << '\n';
+}
+
+void SecondaryRays::spawn(int pixel_idx, int depth, const Vec3 &origin, const Vec3 &dir, int hit_instance_idx,
+                          int hit_trig_idx, float t) {
+    // geometric normal facing the incoming ray
+    Vec3 n = bvh->world_normal(hit_instance_idx, hit_trig_idx);
+    n *= 1.f / sqrtf(dot(n, n));
+    if (dot(n, dir) > 0.f) n = -n;
+    Vec3 p = origin + dir * t + n * offset;
+
+    if (depth == 0 && config->shadow_rays) {
+        // tmax = 1 ends the ray at the light
+        push({ pixel_idx, SpawnedRay::SHADOW, 1, p, Vec3(config->light_x, config->light_y, config->light_z) - p, 1.f, true });
+        (*shadow_rays)++;
+    }
+    for (int i = 0; depth == 0 && i < config->ao_samples; i++) {
+        push({ pixel_idx, SpawnedRay::AO, 1, p, sample_hemisphere(n, pixel_idx, SpawnedRay::AO, 1, i), config->ao_radius, true });
+        (*ao_rays)++;
+    }
+    if (depth < config->diffuse_bounces) {
+        Vec3 bounce_dir = sample_hemisphere(n, pixel_idx, SpawnedRay::DIFFUSE, depth + 1, 0);
+        push({ pixel_idx, SpawnedRay::DIFFUSE, depth + 1, p, bounce_dir, FLT_MAX, false });
+        (*diffuse_rays)++;
+    }
+}
+
+void SecondaryRays::retire(int tag, bool hit, int hit_instance_idx, int hit_trig_idx, float t) {
+    // copied, spawning the next bounce may reuse the tag
+    SpawnedRay ray = rays[tag - num_pixels];
+    free_tags.push_back(tag);
+
+    if (ray.type == SpawnedRay::SHADOW) {
+        lit[ray.pixel_idx] += !hit;
+    } else if (ray.type == SpawnedRay::AO) {
+        ao_unoccluded[ray.pixel_idx] += !hit;
+    } else if (hit) {
+        path_length[ray.pixel_idx]++;
+        spawn(ray.pixel_idx, ray.depth, ray.origin, ray.dir, hit_instance_idx, hit_trig_idx, t);
+    }
+}
+
+void SecondaryRays::write_results(std::ostream &os) const {
+    for (int i = 0; i < num_pixels; i++) {
+        if (lit[i] || ao_unoccluded[i] || path_length[i])
+            os << i << ' ' << lit[i] << ' ' << ao_unoccluded[i] << ' ' << path_length[i] << '\n';
+    }
+    os << "-1\n";
+}
+
+bool SecondaryRays::merge_results(std::istream &is) {
+    int pixel_idx, lit_tmp, ao_unoccluded_tmp, path_length_tmp;
+    while (is >> pixel_idx && pixel_idx >= 0) {
+        if (pixel_idx >= num_pixels || !(is >> lit_tmp >> ao_unoccluded_tmp >> path_length_tmp)) return false;
+        lit[pixel_idx] += lit_tmp;
+        ao_unoccluded[pixel_idx] += ao_unoccluded_tmp;
+        path_length[pixel_idx] += path_length_tmp;
+    }
+    return pixel_idx == -1;
+}
+
+void SecondaryRays::push(const SpawnedRay &ray) {
+    int tag;
+    if (free_tags.empty()) {
+        tag = num_pixels + rays.size();
+        rays.push_back(ray);
+    } else {
+        tag = free_tags.back();
+        free_tags.pop_back();
+        rays[tag - num_pixels] = ray;
+    }
+    queue.push_back(tag);
+    *max_queue_size = std::max(*max_queue_size, (long long)queue.size());
+}
+
+// cosine-weighted direction around n
+Vec3 SecondaryRays::sample_hemisphere(const Vec3 &n, int pixel_idx, int type, int depth, int sample) const {
+    auto hash = [](uint32_t x) {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    };
+    uint32_t state = hash(uint32_t(pixel_idx) * 0x9e3779b9u ^ uint32_t(type << 28 | depth << 20 | sample));
+    float r1 = (state >> 8) * (1.f / (1 << 24));
+    state = hash(state);
+    float r2 = (state >> 8) * (1.f / (1 << 24));
+
+    Vec3 b1 = cross(n, fabsf(n.x) > 0.9f ? Vec3(0.f, 1.f, 0.f) : Vec3(1.f, 0.f, 0.f));
+    b1 *= 1.f / sqrtf(dot(b1, b1));
+    Vec3 b2 = cross(n, b1);
+    float phi = 2.f * float(M_PI) * r1;
+    float r = sqrtf(r2);
+    return b1 * (r * cosf(phi)) + b2 * (r * sinf(phi)) + n * sqrtf(1.f - r2);
+}
+
+#endif //RTCORE_SYSTEMC_SECONDARY_RAYS_HPP
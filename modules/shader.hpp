@@ -1,34 +1,38 @@
 #ifndef RTCORE_SYSTEMC_SHADER_HPP
 #define RTCORE_SYSTEMC_SHADER_HPP
 
-template<int Width, int Height>
+#include <algorithm>
+#include "payloads.hpp"
+
 SC_MODULE(SHADER) {
     // ports
     sc_in<bool> s_valid;
     sc_out<bool> s_ready;
-    sc_in<int> s_ray_id;
-    sc_in<bool> s_hit;
-    sc_in<int> s_hit_trig_idx;
-    sc_in<float> s_t;
-    sc_in<float> s_u;
-    sc_in<float> s_v;
+    sc_in<RayResult> s_result;
 
     sc_in<bool> clk;
     sc_in<bool> srstn;
 
     // high-level objects
+    const Config *config;
     Bvh *bvh;
-    std::unordered_map<int, int> *ray_id_to_pixel_idx;
-    unsigned char framebuffer_r[Width * Height];
-    unsigned char framebuffer_g[Width * Height];
-    unsigned char framebuffer_b[Width * Height];
-    float t[Width * Height];
-    float u[Width * Height];
-    float v[Width * Height];
+    Verifier *verifier;  // nullptr when retired rays are not verified
+    SecondaryRays *secondary_rays;  // nullptr when no rays are spawned
+    FrameOutput output;
 
     SC_HAS_PROCESS(SHADER);
-    SHADER(const sc_module_name &mn, Bvh *bvh, std::unordered_map<int, int> *ray_id_to_pixel_idx)
-        : sc_module(mn), bvh(bvh), ray_id_to_pixel_idx(ray_id_to_pixel_idx) {
+    SHADER(const sc_module_name &mn, const Config *config, Bvh *bvh, Verifier *verifier, SecondaryRays *secondary_rays)
+        : sc_module(mn), config(config), bvh(bvh), verifier(verifier), secondary_rays(secondary_rays), output(config) {
+        TraceSignals &trace = TraceSignals::get();
+        trace.add(name(), "s_valid", s_valid);
+        trace.add(name(), "s_ready", s_ready);
+        trace.add(name(), "s_ray_id", s_result, &RayResult::ray_id);
+        trace.add(name(), "s_tag", s_result, &RayResult::tag);
+        trace.add(name(), "s_hit", s_result, &RayResult::hit);
+        trace.add(name(), "s_hit_trig_idx", s_result, &RayResult::hit_trig_idx);
+        trace.add(name(), "s_hit_instance_idx", s_result, &RayResult::hit_instance_idx);
+        trace.add(name(), "s_t", s_result, &RayResult::t);
+
         SC_METHOD(main)
         sensitive << clk.pos();
         dont_initialize();
@@ -39,44 +43,54 @@ SC_MODULE(SHADER) {
 
     void main() {
         if (s_valid && s_ready) {
-            int pixel_idx = (*ray_id_to_pixel_idx)[s_ray_id];
-            if (s_hit) {
-                float r = bvh->triangles[s_hit_trig_idx].n.x;
-                float g = bvh->triangles[s_hit_trig_idx].n.y;
-                float b = bvh->triangles[s_hit_trig_idx].n.z;
+            const RayResult &result = s_result.read();
+            if (secondary_rays && secondary_rays->is_spawned(result.tag)) {
+                const SpawnedRay &ray = secondary_rays->ray(result.tag);
+                verify(result, ray.pixel_idx, ray.origin, ray.dir, ray.tmax, ray.any_hit);
+                secondary_rays->retire(result.tag, result.hit, result.hit_instance_idx, result.hit_trig_idx, result.t);
+                return;
+            }
+
+            int pixel_idx = result.tag;
+            float dir_x, dir_y, dir_z;
+            config->ray_dir(pixel_idx, dir_x, dir_y, dir_z);
+            Vec3 origin(config->origin_x, config->origin_y, config->origin_z);
+            Vec3 dir(dir_x, dir_y, dir_z);
+            if (result.hit) {
+                Vec3 n = bvh->world_normal(result.hit_instance_idx, result.hit_trig_idx);
+                float r = n.x;
+                float g = n.y;
+                float b = n.z;
                 float length = sqrtf(r * r + g * g + b * b);
                 r = (r / length + 1.f) / 2.f;
                 g = (g / length + 1.f) / 2.f;
                 b = (b / length + 1.f) / 2.f;
-                framebuffer_r[pixel_idx] = std::clamp(int(256.f * r), 0, 255);
-                framebuffer_g[pixel_idx] = std::clamp(int(256.f * g), 0, 255);
-                framebuffer_b[pixel_idx] = std::clamp(int(256.f * b), 0, 255);
-                t[pixel_idx] = s_t;
-                u[pixel_idx] = s_u;
-                v[pixel_idx] = s_v;
+                output.write(pixel_idx, std::clamp(int(256.f * r), 0, 255), std::clamp(int(256.f * g), 0, 255),
+                             std::clamp(int(256.f * b), 0, 255), result.t, result.u, result.v);
             } else {
-                framebuffer_r[pixel_idx] = 0;
-                framebuffer_g[pixel_idx] = 0;
-                framebuffer_b[pixel_idx] = 0;
-                t[pixel_idx] = -1.f;
-                u[pixel_idx] = -1.f;
-                v[pixel_idx] = -1.f;
+                output.write(pixel_idx, 0, 0, 0, -1.f, -1.f, -1.f);
+            }
+
+            verify(result, pixel_idx, origin, dir, FLT_MAX, config->any_hit);
+            if (result.hit && secondary_rays) {
+                secondary_rays->spawn(pixel_idx, 0, origin, dir, result.hit_instance_idx, result.hit_trig_idx,
+                                      result.t);
             }
         }
     }
 
-    void update_s_ready() {
-        s_ready = srstn;
+    void verify(const RayResult &result, int pixel_idx, const Vec3 &origin, const Vec3 &dir, float tmax,
+                bool any_hit) {
+        if (verifier && !verifier->check(result.ray_id, pixel_idx, origin, dir, tmax, any_hit, result.hit,
+                                         result.hit_instance_idx, result.hit_trig_idx, result.t, result.u, result.v)
+            && verifier->mismatches == config->verify_max_mismatches) {
+            std::cerr << "Stopping after " << verifier->mismatches << " mismatches" << std::endl;
+            sc_stop();
+        }
     }
 
-    ~SHADER() {
-        std::ofstream image_file("image.ppm");
-        std::ofstream intersection_file("intersection.txt");
-        image_file << "P3\n" << Width << ' ' << Height << "\n255\n";
-        for(int i = 0; i < Width * Height; i++) {
-            image_file << (int)framebuffer_r[i] << ' ' << (int)framebuffer_g[i] << ' ' << (int)framebuffer_b[i] << '\n';
-            intersection_file << t[i] << ' ' << u[i] << ' ' << v[i] << '\n';
-        }
+    void update_s_ready() {
+        s_ready = srstn;
     }
 };
 
@@ -2,23 +2,50 @@
 #define RTCORE_SYSTEMC_TESTBENCH_HPP
 
 #include <fstream>
-#include <unordered_map>
+#include <map>
+#include <utility>
+#include <vector>
+#include "../custom_structs/config.hpp"
+#include "tracer.hpp"
+#include "secondary_rays.hpp"
 #include "raygen.hpp"
 #include "rtcore/rtcore.hpp"
+#include "rtcore/rtcore_lt.hpp"
+#include "cluster.hpp"
+#include "verifier.hpp"
+#include "frame_output.hpp"
 #include "shader.hpp"
 
 SC_MODULE(TESTBENCH) {
     // parameters
-    static constexpr int width = 600;
-    static constexpr int height = 600;
+    static constexpr int max_working_rays = 8;
+    static constexpr int num_trvs = 2;
+    static constexpr int ist_latency = 4;
+    static constexpr int ist_lanes = 2;
+
+    struct InFlightRay {
+        int ray_id;  // given by RTCORE
+        long long issue_cycle;
+    };
 
     // submodules
-    RAYGEN<width, height> raygen;
-    RTCORE<4> rtcore;
-    SHADER<width, height> shader;
+    RAYGEN raygen;
+    RTCORE_BASE *rtcore;  // RTCORE, RTCORE_LT when loosely timed, or a CLUSTER of them
+    SHADER shader;
+    TRACER *tracer;  // nullptr when tracing is off
 
     // high-level objects
-    std::unordered_map<int, int> ray_id_to_pixel_idx;
+    const Config *config;
+    SecondaryRays *secondary_rays;  // nullptr when no rays are spawned
+    long long cycle;  // since reset
+    long long issued;  // rays accepted by RTCORE
+    long long retired;  // rays accepted by SHADER
+    long long last_progress_cycle;  // last cycle with a handshake on any channel
+    int drained_cycles;  // consecutive cycles with nothing left to send or retire
+    std::map<int, InFlightRay> in_flight;  // ray of each tag, kept for the watchdog
+    std::vector<std::pair<int, int>> handshakes;  // valid and ready of the channels in TraceSignals, for the watchdog
+    bool finished;  // every ray was retired
+    bool deadlocked;  // stopped by the watchdog
 
     // internal signals
     sc_clock clk;
@@ -27,112 +54,98 @@ SC_MODULE(TESTBENCH) {
     // RAYGEN-RTCORE
     sc_signal<bool> raygen_rtcore_valid;
     sc_signal<bool> raygen_rtcore_ready;
-    sc_signal<float> raygen_rtcore_origin_x;
-    sc_signal<float> raygen_rtcore_origin_y;
-    sc_signal<float> raygen_rtcore_origin_z;
-    sc_signal<float> raygen_rtcore_dir_x;
-    sc_signal<float> raygen_rtcore_dir_y;
-    sc_signal<float> raygen_rtcore_dir_z;
-    sc_signal<float> raygen_rtcore_tmax;
-    sc_signal<int> raygen_rtcore_ray_id;
+    sc_signal<Ray> raygen_rtcore_ray;
 
     // RTCORE-SHADER
     sc_signal<bool> rtcore_shader_valid;
     sc_signal<bool> rtcore_shader_ready;
-    sc_signal<int> rtcore_shader_ray_id;
-    sc_signal<bool> rtcore_shader_hit;
-    sc_signal<int> rtcore_shader_hit_trig_idx;
-    sc_signal<float> rtcore_shader_t;
-    sc_signal<float> rtcore_shader_u;
-    sc_signal<float> rtcore_shader_v;
-
-    // vcd file
-    sc_trace_file *tf;
+    sc_signal<RayResult> rtcore_shader_result;
 
     SC_HAS_PROCESS(TESTBENCH);
-    TESTBENCH(const sc_module_name &mn, Bvh *bvh)
-        : sc_module(mn), raygen("raygen", &ray_id_to_pixel_idx),
-          rtcore("rtcore", bvh), shader("shader", bvh, &ray_id_to_pixel_idx),
-          clk("clk", 2, SC_PS) {
+    // mems holds the memory of each RT core, or is empty for zero-latency fetches
+    TESTBENCH(const sc_module_name &mn, const Config *config, Bvh *bvh, const std::vector<Memory *> &mems,
+              Verifier *verifier, SecondaryRays *secondary_rays)
+        : sc_module(mn), raygen("raygen", config, secondary_rays),
+          rtcore(config->num_rtcores == 1 ? new_rtcore("rtcore", config, bvh, mems.empty() ? nullptr : mems[0])
+                 : new CLUSTER("rtcore", config, secondary_rays, max_working_rays, [&](const char *name, int core) {
+                       return new_rtcore(name, config, bvh, mems.empty() ? nullptr : mems[core]);
+                   })),
+          shader("shader", config, bvh, verifier, secondary_rays),
+          config(config), secondary_rays(secondary_rays), cycle(0), issued(0), retired(0), last_progress_cycle(0),
+          drained_cycles(0), finished(false), deadlocked(false), clk("clk", 2, SC_PS) {
         // link RAYGEN
         raygen.clk(clk);
         raygen.srstn(srstn);
         raygen.m_valid(raygen_rtcore_valid);
         raygen.m_ready(raygen_rtcore_ready);
-        raygen.m_origin_x(raygen_rtcore_origin_x);
-        raygen.m_origin_y(raygen_rtcore_origin_y);
-        raygen.m_origin_z(raygen_rtcore_origin_z);
-        raygen.m_dir_x(raygen_rtcore_dir_x);
-        raygen.m_dir_y(raygen_rtcore_dir_y);
-        raygen.m_dir_z(raygen_rtcore_dir_z);
-        raygen.m_tmax(raygen_rtcore_tmax);
-        raygen.m_ray_id(raygen_rtcore_ray_id);
+        raygen.m_ray(raygen_rtcore_ray);
 
         // link RTCORE
-        rtcore.s_valid(raygen_rtcore_valid);
-        rtcore.s_ready(raygen_rtcore_ready);
-        rtcore.s_origin_x(raygen_rtcore_origin_x);
-        rtcore.s_origin_y(raygen_rtcore_origin_y);
-        rtcore.s_origin_z(raygen_rtcore_origin_z);
-        rtcore.s_dir_x(raygen_rtcore_dir_x);
-        rtcore.s_dir_y(raygen_rtcore_dir_y);
-        rtcore.s_dir_z(raygen_rtcore_dir_z);
-        rtcore.s_tmax(raygen_rtcore_tmax);
-        rtcore.s_ray_id(raygen_rtcore_ray_id);
-        rtcore.clk(clk);
-        rtcore.srstn(srstn);
-        rtcore.m_valid(rtcore_shader_valid);
-        rtcore.m_ready(rtcore_shader_ready);
-        rtcore.m_ray_id(rtcore_shader_ray_id);
-        rtcore.m_hit(rtcore_shader_hit);
-        rtcore.m_hit_trig_idx(rtcore_shader_hit_trig_idx);
-        rtcore.m_t(rtcore_shader_t);
-        rtcore.m_u(rtcore_shader_u);
-        rtcore.m_v(rtcore_shader_v);
+        rtcore->s_valid(raygen_rtcore_valid);
+        rtcore->s_ready(raygen_rtcore_ready);
+        rtcore->s_ray(raygen_rtcore_ray);
+        rtcore->clk(clk);
+        rtcore->srstn(srstn);
+        rtcore->m_valid(rtcore_shader_valid);
+        rtcore->m_ready(rtcore_shader_ready);
+        rtcore->m_result(rtcore_shader_result);
 
         // link SHADER
         shader.s_valid(rtcore_shader_valid);
         shader.s_ready(rtcore_shader_ready);
-        shader.s_ray_id(rtcore_shader_ray_id);
-        shader.s_hit(rtcore_shader_hit);
-        shader.s_hit_trig_idx(rtcore_shader_hit_trig_idx);
-        shader.s_t(rtcore_shader_t);
-        shader.s_u(rtcore_shader_u);
-        shader.s_v(rtcore_shader_v);
+        shader.s_result(rtcore_shader_result);
         shader.clk(clk);
         shader.srstn(srstn);
 
         SC_THREAD(main)
 
-        tf = sc_create_vcd_trace_file("wave");
-        /*
-        sc_trace(tf, clk, "clk");
-        sc_trace(tf, srstn, "srstn");
-        sc_trace(tf, raygen.m_valid, "raygen.m_valid");
-        sc_trace(tf, rtcore.rd.s_alloc_ready, "rtcore.rd.s_alloc_ready");
-        sc_trace(tf, rtcore.rd.s_alloc_ray_id, "rtcore.rd.s_alloc_ray_id");
-        sc_trace(tf, rtcore.rd.m_valid, "rtcore.rd.m_valid");
-        sc_trace(tf, rtcore.rd.m_ray_id, "rtcore.rd.m_ray_id");
-        sc_trace(tf, rtcore.trv.s_ready, "rtcore.trv.s_ready");
-        sc_trace(tf, rtcore.trv.m_list_valid, "rtcore.trv.m_list_valid");
-        sc_trace(tf, rtcore.trv.m_list_ray_id, "rtcore.trv.m_list_ray_id");
-        sc_trace(tf, rtcore.trv.m_list_node_a_idx, "rtcore.trv.m_list_node_a_idx");
-        sc_trace(tf, rtcore.trv.m_list_node_b_valid, "rtcore.trv.m_list_node_b_valid");
-        sc_trace(tf, rtcore.trv.m_list_node_b_idx, "rtcore.trv.m_list_node_b_idx");
-        sc_trace(tf, rtcore.trv.m_post_valid, "rtcore.trv.m_post_valid");
-        sc_trace(tf, rtcore.trv.m_post_ray_id, "rtcore.trv.m_post_ray_id");
-        sc_trace(tf, rtcore.list.s_ready, "rtcore.list.s_ready");
-        sc_trace(tf, rtcore.list.m_valid, "rtcore.list.m_valid");
-        sc_trace(tf, rtcore.list.m_ray_id, "rtcore.list.m_ray_id");
-        sc_trace(tf, rtcore.list.m_trig_idx, "rtcore.list.m_trig_idx");
-        sc_trace(tf, rtcore.list.m_is_last_trig, "rtcore.list.m_is_last_trig");
-        sc_trace(tf, rtcore.post.s_ready, "rtcore.post.s_ready");
-        sc_trace(tf, rtcore.post.m_valid, "rtcore.post.m_valid");
-        sc_trace(tf, rtcore.post.m_ray_id, "rtcore.post.m_ray_id");
-        sc_trace(tf, rtcore.ist.m_valid, "rtcore.ist.m_valid");
-        sc_trace(tf, rtcore.ist.m_ray_id, "rtcore.ist.m_ray_id");
-        sc_trace(tf, shader.s_ready, "shader.s_ready");
-         */
+        SC_METHOD(check_progress)
+        sensitive << clk.posedge_event();
+        dont_initialize();
+
+        // signals register themselves when their units are constructed, so the watchdog and the tracer come last
+        TraceSignals &trace = TraceSignals::get();
+        if (config->watchdog_cycles > 0) {
+            // a channel is a <prefix>valid signal with a <prefix>ready one in the same unit
+            std::map<std::string, int> indices;
+            for (int i = 0; i < (int)trace.signals.size(); i++) indices[trace.signals[i].name] = i;
+            for (const auto &[signal_name, valid_idx] : indices) {
+                if (signal_name.size() < 5 || signal_name.compare(signal_name.size() - 5, 5, "valid") != 0) continue;
+                auto ready = indices.find(signal_name.substr(0, signal_name.size() - 5) + "ready");
+                if (ready != indices.end()) handshakes.push_back({ valid_idx, ready->second });
+            }
+        }
+        trace.add(name(), "srstn", srstn);
+        tracer = nullptr;
+        if (!config->trace.empty()) {
+            tracer = new TRACER("tracer", config);
+            tracer->clk(clk);
+        }
+    }
+
+    static RTCORE_BASE *new_rtcore(const char *name, const Config *config, Bvh *bvh, Memory *mem) {
+        if (config->bvh_width == 8) return new_rtcore<8>(name, config, bvh, mem);
+        if (config->bvh_width == 4) return new_rtcore<4>(name, config, bvh, mem);
+        return new_rtcore<2>(name, config, bvh, mem);
+    }
+
+    template<int BvhWidth>
+    static RTCORE_BASE *new_rtcore(const char *name, const Config *config, Bvh *bvh, Memory *mem) {
+        if (config->loosely_timed) {
+            return new RTCORE_LT<max_working_rays, num_trvs, ist_latency, ist_lanes, BvhWidth>(
+                name, bvh, config->short_stack_size);
+        }
+        return new RTCORE<max_working_rays, num_trvs, ist_latency, ist_lanes, BvhWidth>(
+            name, bvh, mem, config->short_stack_size, sched_config(config));
+    }
+
+    static SchedulerConfig sched_config(const Config *config) {
+        SchedulerConfig sched_config;
+        if (config->sched_policy == "node") sched_config.policy = SchedulerConfig::NODE;
+        else if (config->sched_policy == "treelet") sched_config.policy = SchedulerConfig::TREELET;
+        sched_config.window = config->sched_window;
+        sched_config.treelet_nodes = config->treelet_nodes;
+        return sched_config;
     }
 
     void main() {
@@ -141,8 +154,67 @@ SC_MODULE(TESTBENCH) {
         srstn = true;
     }
 
+    // stops the simulation once every ray was retired, or when the watchdog sees no handshake on any channel for
+    // watchdog_cycles cycles. The frame is done on the second cycle in a row with nothing left, since SHADER may spawn
+    // rays after this method ran in the cycle of the last retirement.
+    void check_progress() {
+        if (!srstn) return;
+        cycle++;
+
+        if (raygen_rtcore_valid && raygen_rtcore_ready) {
+            issued++;
+            last_progress_cycle = cycle;
+            if (config->watchdog_cycles > 0)
+                in_flight[raygen_rtcore_ray.read().tag] = { rtcore->accepted_ray_id(), cycle };
+        }
+        if (rtcore_shader_valid && rtcore_shader_ready) {
+            retired++;
+            last_progress_cycle = cycle;
+            if (config->watchdog_cycles > 0) in_flight.erase(rtcore_shader_result.read().tag);
+        }
+        const std::vector<TraceSignals::Signal> &signals = TraceSignals::get().signals;
+        for (const auto &[valid_idx, ready_idx] : handshakes) {
+            if (signals[valid_idx].read() && signals[ready_idx].read()) {
+                last_progress_cycle = cycle;
+                break;
+            }
+        }
+
+        bool drained = (issued == retired && !raygen_rtcore_valid && raygen.pixel_idx == raygen.num_pixels
+                        && (!secondary_rays || secondary_rays->queue.empty()));
+        drained_cycles = (drained ? drained_cycles + 1 : 0);
+        if (drained_cycles == 2) {
+            finished = true;
+            sc_stop();
+        } else if (config->watchdog_cycles > 0 && cycle - last_progress_cycle == config->watchdog_cycles) {
+            report_deadlock();
+            deadlocked = true;
+            sc_stop();
+        }
+    }
+
+    void report_deadlock() const {
+        std::cerr << "Deadlock: no handshake on any channel for " << config->watchdog_cycles << " cycles, at cycle "
+                  << cycle << std::endl;
+        std::cerr << issued - retired << " rays in flight (tag: ray id, cycle issued):";
+        for (const auto &[tag, ray] : in_flight)
+            std::cerr << ' ' << tag << ": " << ray.ray_id << ", " << ray.issue_cycle;
+        std::cerr << std::endl << "State of every unit:" << std::endl;
+        for (const TraceSignals::Signal &signal : TraceSignals::get().signals)
+            std::cerr << "  " << signal.name << " = " << signal.value() << std::endl;
+    }
+
+    // explains why the simulation stopped before every ray was retired
+    void report_unfinished() const {
+        if (finished || deadlocked) return;
+        std::cerr << "Stopped at cycle " << cycle << " before every ray was retired: " << retired << " of " << issued
+                  << " issued rays retired, " << (raygen.pixel_idx == raygen.num_pixels ? "all" : "not all")
+                  << " primary rays sent" << std::endl;
+    }
+
     ~TESTBENCH() {
-        sc_close_vcd_trace_file(tf);
+        delete rtcore;
+        delete tracer;
     }
 };
 
@@ -0,0 +1,156 @@
+#ifndef RTCORE_SYSTEMC_TRACER_HPP
+#define RTCORE_SYSTEMC_TRACER_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../custom_structs/config.hpp"
+#include "../custom_structs/trace_signals.hpp"
+
+// records the registered signals whose names match the trace patterns into a compact binary file, sampled at every
+// rising clock edge in [trace_start, trace_stop) while the trigger holds. Only changed values are written:
+//   header: "RTCTRACE", uint32 version, uint32 number of signals, then per signal uint8 type, uint16 name length, name
+//   record: varint cycles since the previous record, varint number of changes, then per change varint signal index
+//           and the 32-bit value (little endian)
+// trace-to-vcd converts the file to VCD. Values hold between records, also while the trigger is off.
+SC_MODULE(TRACER) {
+    static constexpr uint32_t VERSION = 1;
+
+    // ports
+    sc_in<bool> clk;
+
+    // high-level objects
+    std::vector<const TraceSignals::Signal *> traced;
+    std::vector<const TraceSignals::Signal *> triggers;  // the trigger holds when any of them has trigger_value
+    double trigger_value;
+    long long start;
+    long long stop;  // -1 never stops
+    std::ofstream file;
+
+    // internal states
+    long long cycle;
+    long long last_record_cycle;
+    std::vector<uint32_t> values;  // last written
+    bool any_record;
+    std::vector<std::pair<int, uint32_t>> changes;  // signal index and value, reused every cycle
+
+    SC_HAS_PROCESS(TRACER);
+    TRACER(const sc_module_name &mn, const Config *config);
+
+    void main();
+
+    // glob pattern with * and ?, matched against the full name and the name without the top-level module
+    static bool matches(const std::string &pattern, const std::string &name);
+
+private:
+    static bool glob(const char *pattern, const char *name);
+    void write_varint(uint64_t x);
+    void write_u32(uint32_t x);
+};
+
+TRACER::TRACER(const sc_module_name &mn, const Config *config)
+    : sc_module(mn), trigger_value(0.), start(config->trace_start), stop(config->trace_stop),
+      file(config->trace_file, std::ios::binary), cycle(0), last_record_cycle(0), any_record(false) {
+    std::vector<std::string> patterns;
+    for (size_t begin = 0, end; begin <= config->trace.size(); begin = end + 1) {
+        end = config->trace.find(',', begin);
+        if (end == std::string::npos) end = config->trace.size();
+        if (end > begin) patterns.push_back(config->trace.substr(begin, end - begin));
+    }
+
+    std::string trigger_pattern;
+    if (!config->trace_trigger.empty()) {
+        size_t eq = config->trace_trigger.rfind('=');
+        trigger_pattern = config->trace_trigger.substr(0, eq);
+        trigger_value = std::stod(config->trace_trigger.substr(eq + 1));
+    }
+
+    for (const TraceSignals::Signal &signal : TraceSignals::get().signals) {
+        for (const std::string &pattern : patterns) {
+            if (matches(pattern, signal.name)) {
+                traced.push_back(&signal);
+                break;
+            }
+        }
+        if (!trigger_pattern.empty() && matches(trigger_pattern, signal.name)) triggers.push_back(&signal);
+    }
+    if (traced.empty()) std::cerr << "No signal matches --trace=" << config->trace << std::endl;
+    if (!trigger_pattern.empty() && triggers.empty())
+        std::cerr << "No signal matches the trace trigger " << trigger_pattern << std::endl;
+    values.resize(traced.size());
+
+    if (!file) std::cerr << "Cannot create trace file " << config->trace_file << std::endl;
+    file.write("RTCTRACE", 8);
+    write_u32(VERSION);
+    write_u32(traced.size());
+    for (const TraceSignals::Signal *signal : traced) {
+        file.put(signal->type);
+        uint16_t length = signal->name.size();
+        file.put(length & 0xff);
+        file.put(length >> 8);
+        file.write(signal->name.data(), length);
+    }
+
+    SC_METHOD(main)
+    sensitive << clk.pos();
+    dont_initialize();
+}
+
+void TRACER::main() {
+    long long now = cycle++;
+    if (now < start || (stop >= 0 && now >= stop)) return;
+
+    bool triggered = triggers.empty();
+    for (int i = 0; i < triggers.size() && !triggered; i++)
+        triggered = (triggers[i]->value() == trigger_value);
+    if (!triggered) return;
+
+    changes.clear();
+    for (int i = 0; i < traced.size(); i++) {
+        uint32_t value = traced[i]->read();
+        if (!any_record || value != values[i]) {
+            changes.emplace_back(i, value);
+            values[i] = value;
+        }
+    }
+    if (changes.empty()) return;
+
+    write_varint(now - last_record_cycle);
+    write_varint(changes.size());
+    for (const auto &[idx, value] : changes) {
+        write_varint(idx);
+        write_u32(value);
+    }
+    last_record_cycle = now;
+    any_record = true;
+}
+
+bool TRACER::matches(const std::string &pattern, const std::string &name) {
+    size_t dot = name.find('.');
+    return glob(pattern.c_str(), name.c_str()) ||
+           (dot != std::string::npos && glob(pattern.c_str(), name.c_str() + dot + 1));
+}
+
+bool TRACER::glob(const char *pattern, const char *name) {
+    if (*pattern == '\0') return *name == '\0';
+    if (*pattern == '*') return glob(pattern + 1, name) || (*name != '\0' && glob(pattern, name + 1));
+    return *name != '\0' && (*pattern == '?' || *pattern == *name) && glob(pattern + 1, name + 1);
+}
+
+void TRACER::write_varint(uint64_t x) {
+    while (x >= 0x80) {
+        file.put(char(x | 0x80));
+        x >>= 7;
+    }
+    file.put(char(x));
+}
+
+void TRACER::write_u32(uint32_t x) {
+    char bytes[4] = { char(x), char(x >> 8), char(x >> 16), char(x >> 24) };
+    file.write(bytes, 4);
+}
+
+#endif //RTCORE_SYSTEMC_TRACER_HPP
@@ -0,0 +1,163 @@
+#ifndef RTCORE_SYSTEMC_VERIFIER_HPP
+#define RTCORE_SYSTEMC_VERIFIER_HPP
+
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "../custom_structs/config.hpp"
+#include "../custom_structs/perf_counters.hpp"
+
+#ifdef RTCORE_VERIFIER
+#include "bvh/triangle.hpp"
+#include "bvh/sweep_sah_builder.hpp"
+#include "bvh/single_ray_traverser.hpp"
+#include "bvh/primitive_intersectors.hpp"
+
+// checks every ray retired by SHADER against the reference traverser of the bvh library (the one used by
+// gen-references). The reference BVH is built over the reordered triangles of our BVH, so triangle indices match.
+// A two-level BVH gets one reference BVH per BLAS, and the reference intersects the ray with every instance in turn.
+struct Verifier {
+    using RefVector3 = ::bvh::Vector3<float>;
+    using RefTriangle = ::bvh::Triangle<float>;
+    using RefRay = ::bvh::Ray<float>;
+    using RefBvh = ::bvh::Bvh<float>;
+    using RefIntersector = ::bvh::ClosestPrimitiveIntersector<RefBvh, RefTriangle>;
+    using RefTraverser = ::bvh::SingleRayTraverser<RefBvh>;
+
+    // reference BVH over the triangles [first_trig_idx, first_trig_idx + triangles.size()) of our BVH
+    struct Reference {
+        Reference(const Bvh *scene, int first_trig_idx, int num_trigs);
+
+        int first_trig_idx;
+        std::vector<RefTriangle> triangles;
+        RefBvh bvh;
+        std::unique_ptr<RefIntersector> intersector;
+        std::unique_ptr<RefTraverser> traverser;
+    };
+
+    Verifier(const Config *config, const Bvh *scene);
+
+    // returns false and reports the ray when it does not match the reference. Any-hit rays return whichever hit
+    // was found first, so only whether something is hit is compared for them
+    bool check(int ray_id, int pixel_idx, const Vec3 &origin, const Vec3 &dir, float tmax, bool any_hit,
+               bool hit, int hit_instance_idx, int hit_trig_idx, float t, float u, float v);
+
+    const Config *config;
+    const Bvh *scene;
+    std::vector<std::unique_ptr<Reference>> references;
+    std::vector<int> instance_references;  // reference of the BLAS of each instance
+
+    // performance counters
+    long long &rays;
+    long long &mismatches;
+};
+
+Verifier::Reference::Reference(const Bvh *scene, int first_trig_idx, int num_trigs) : first_trig_idx(first_trig_idx) {
+    for (int i = first_trig_idx; i < first_trig_idx + num_trigs; i++) {
+        const Triangle &trig = scene->triangles[i];
+        Vec3 p1 = trig.p1();
+        Vec3 p2 = trig.p2();
+        triangles.emplace_back(RefVector3(trig.p0.x, trig.p0.y, trig.p0.z), RefVector3(p1.x, p1.y, p1.z),
+                               RefVector3(p2.x, p2.y, p2.z));
+    }
+
+    auto [bboxes, centers] = ::bvh::compute_bounding_boxes_and_centers(triangles.data(), triangles.size());
+    auto global_bbox = ::bvh::compute_bounding_boxes_union(bboxes.get(), triangles.size());
+    ::bvh::SweepSahBuilder<RefBvh> builder(bvh);
+    builder.build(global_bbox, bboxes.get(), centers.get(), triangles.size());
+
+    intersector = std::make_unique<RefIntersector>(bvh, triangles.data());
+    traverser = std::make_unique<RefTraverser>(bvh);
+}
+
+Verifier::Verifier(const Config *config, const Bvh *scene)
+    : config(config), scene(scene), rays(PerfCounters::get().counter("verifier", "rays")),
+      mismatches(PerfCounters::get().counter("verifier", "mismatches")) {
+    if (!scene->instances) {
+        references.push_back(std::make_unique<Reference>(scene, 0, scene->num_triangles));
+        return;
+    }
+    for (int i = 0; i < scene->num_instances; i++) {
+        const Bvh::Instance &inst = scene->instances[i];
+        int ref_idx = 0;
+        while (ref_idx < (int)references.size() && references[ref_idx]->first_trig_idx != inst.first_trig_idx) ref_idx++;
+        if (ref_idx == (int)references.size())
+            references.push_back(std::make_unique<Reference>(scene, inst.first_trig_idx, inst.num_trigs));
+        instance_references.push_back(ref_idx);
+    }
+}
+
+bool Verifier::check(int ray_id, int pixel_idx, const Vec3 &origin, const Vec3 &dir, float tmax, bool any_hit,
+                     bool hit, int hit_instance_idx, int hit_trig_idx, float t, float u, float v) {
+    bool ref_hit = false;
+    int ref_instance_idx = -1;
+    int ref_trig_idx = -1;
+    float ref_t = tmax, ref_u = 0.f, ref_v = 0.f;
+    auto traverse = [&](const Reference &ref, const Vec3 &ray_origin, const Vec3 &ray_dir, int instance_idx) {
+        RefRay ray(RefVector3(ray_origin.x, ray_origin.y, ray_origin.z), RefVector3(ray_dir.x, ray_dir.y, ray_dir.z),
+                   0.f, ref_t);
+        auto result = ref.traverser->traverse(ray, *ref.intersector);
+        if (!result) return;
+        ref_hit = true;
+        ref_instance_idx = instance_idx;
+        ref_trig_idx = ref.first_trig_idx + int(result->primitive_index);
+        ref_t = result->intersection.t;
+        ref_u = result->intersection.u;
+        ref_v = result->intersection.v;
+    };
+    if (!scene->instances) {
+        traverse(*references[0], origin, dir, -1);
+    } else {
+        // same transform as TRV, distances along the ray do not change
+        for (int i = 0; i < scene->num_instances; i++) {
+            const float *to_object = scene->instances[i].to_object;
+            traverse(*references[instance_references[i]], Bvh::Instance::apply(to_object, origin, 1.f),
+                     Bvh::Instance::apply(to_object, dir, 0.f), i);
+        }
+    }
+    rays++;
+
+    // a different triangle at the same distance is a hit on a shared edge, u and v are only comparable otherwise
+    float tolerance = config->verify_tolerance;
+    bool match = (hit == ref_hit);
+    if (match && hit && !any_hit) {
+        match = std::fabs(t - ref_t) <= tolerance * std::max(1.f, std::fabs(ref_t));
+        if (match && hit_instance_idx == ref_instance_idx && hit_trig_idx == ref_trig_idx) {
+            match = std::fabs(u - ref_u) <= tolerance && std::fabs(v - ref_v) <= tolerance;
+        }
+    }
+    if (match) return true;
+
+    mismatches++;
+    std::cerr << "Mismatch for ray " << ray_id << " at pixel (" << pixel_idx % config->width << ", "
+              << pixel_idx / config->width << "): got ";
+    if (hit) {
+        if (hit_instance_idx >= 0) std::cerr << "instance " << hit_instance_idx << " ";
+        std::cerr << "triangle " << hit_trig_idx << " t = " << t << " u = " << u << " v = " << v;
+    } else {
+        std::cerr << "no hit";
+    }
+    std::cerr << ", expected ";
+    if (ref_hit) {
+        if (ref_instance_idx >= 0) std::cerr << "instance " << ref_instance_idx << " ";
+        std::cerr << "triangle " << ref_trig_idx << " t = " << ref_t << " u = " << ref_u << " v = " << ref_v;
+    } else {
+        std::cerr << "no hit";
+    }
+    std::cerr << std::endl;
+    return false;
+}
+
+#else
+// built without the bvh library (RTCORE_VERIFIER undefined). main.cpp rejects --verify=1, so SHADER never gets one
+struct Verifier {
+    bool check(int ray_id, int pixel_idx, const Vec3 &origin, const Vec3 &dir, float tmax, bool any_hit,
+               bool hit, int hit_instance_idx, int hit_trig_idx, float t, float u, float v) { return true; }
+
+    long long rays = 0;
+    long long mismatches = 0;
+};
+#endif //RTCORE_VERIFIER
+
+#endif //RTCORE_SYSTEMC_VERIFIER_HPP
@@ -0,0 +1,137 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// converts a trace written by TRACER (modules/tracer.hpp) to VCD, with one time unit per clock cycle and the dotted
+// signal names as nested scopes
+// usage: trace-to-vcd [trace_path] [vcd_path]
+
+struct Signal {
+    uint8_t type;  // 0 bool, 1 int, 2 float, as in TraceSignals
+    std::string name;
+    std::string id;  // VCD identifier
+};
+
+struct Scope {
+    std::map<std::string, Scope> children;
+    std::vector<int> signals;
+};
+
+bool read_u32(std::istream &is, uint32_t &x) {
+    unsigned char bytes[4];
+    if (!is.read(reinterpret_cast<char *>(bytes), 4)) return false;
+    x = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | uint32_t(bytes[3]) << 24;
+    return true;
+}
+
+bool read_varint(std::istream &is, uint64_t &x) {
+    x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = is.get();
+        if (byte == EOF) return false;
+        x |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void write_scope(std::ostream &os, const std::string &name, const Scope &scope, const std::vector<Signal> &signals) {
+    os << "$scope module " << name << " $end\n";
+    for (int i : scope.signals) {
+        const Signal &signal = signals[i];
+        std::string leaf = signal.name.substr(signal.name.rfind('.') + 1);
+        if (signal.type == 0) os << "$var wire 1 " << signal.id << ' ' << leaf << " $end\n";
+        else if (signal.type == 1) os << "$var integer 32 " << signal.id << ' ' << leaf << " $end\n";
+        else os << "$var real 32 " << signal.id << ' ' << leaf << " $end\n";
+    }
+    for (const auto &[child_name, child] : scope.children) write_scope(os, child_name, child, signals);
+    os << "$upscope $end\n";
+}
+
+void write_value(std::ostream &os, const Signal &signal, uint32_t value) {
+    if (signal.type == 0) {
+        os << (value ? '1' : '0') << signal.id << '\n';
+    } else if (signal.type == 1) {
+        os << 'b';
+        int bit = 31;
+        while (bit > 0 && !(value >> bit & 1)) bit--;
+        for (; bit >= 0; bit--) os << char('0' + (value >> bit & 1));
+        os << ' ' << signal.id << '\n';
+    } else {
+        float f;
+        std::memcpy(&f, &value, sizeof(f));
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "r%.9g ", f);
+        os << buf << signal.id << '\n';
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *trace_path = argc > 1 ? argv[1] : "trace.bin";
+    const char *vcd_path = argc > 2 ? argv[2] : "wave.vcd";
+
+    std::ifstream trace(trace_path, std::ios::binary);
+    char magic[8];
+    uint32_t version, num_signals;
+    if (!trace.read(magic, 8) || std::memcmp(magic, "RTCTRACE", 8) != 0 || !read_u32(trace, version) ||
+        version != 1 || !read_u32(trace, num_signals)) {
+        std::cerr << "Not a trace file: " << trace_path << std::endl;
+        return 1;
+    }
+
+    std::vector<Signal> signals(num_signals);
+    Scope root;
+    for (int i = 0; i < (int)num_signals; i++) {
+        Signal &signal = signals[i];
+        unsigned char length[2];
+        signal.type = trace.get();
+        trace.read(reinterpret_cast<char *>(length), 2);
+        signal.name.resize(length[0] | length[1] << 8);
+        trace.read(signal.name.data(), signal.name.size());
+        if (!trace) {
+            std::cerr << "Truncated header in " << trace_path << std::endl;
+            return 1;
+        }
+        // printable identifiers in base 94
+        for (int x = i; ; x = x / 94 - 1) {
+            signal.id += char('!' + x % 94);
+            if (x < 94) break;
+        }
+
+        Scope *scope = &root;
+        for (size_t begin = 0, dot; (dot = signal.name.find('.', begin)) != std::string::npos; begin = dot + 1)
+            scope = &scope->children[signal.name.substr(begin, dot - begin)];
+        scope->signals.push_back(i);
+    }
+
+    std::ofstream vcd(vcd_path);
+    vcd << "$comment converted from " << trace_path << ", one time unit per clock cycle $end\n";
+    vcd << "$timescale 1 ns $end\n";
+    for (const auto &[name, scope] : root.children) write_scope(vcd, name, scope, signals);
+    vcd << "$enddefinitions $end\n";
+
+    uint64_t cycle = 0, delta, num_changes, idx;
+    uint32_t value;
+    long long records = 0;
+    while (read_varint(trace, delta)) {
+        cycle += delta;
+        vcd << '#' << cycle << '\n';
+        if (!read_varint(trace, num_changes)) break;
+        for (uint64_t i = 0; i < num_changes; i++) {
+            if (!read_varint(trace, idx) || !read_u32(trace, value) || idx >= num_signals) {
+                // a run killed while tracing leaves a partial record
+                std::cerr << "Truncated record at cycle " << cycle << std::endl;
+                return 0;
+            }
+            write_value(vcd, signals[idx], value);
+        }
+        records++;
+    }
+    std::cout << num_signals << " signals, " << records << " records, last at cycle " << cycle << std::endl;
+    return 0;
+}